@@ -0,0 +1,201 @@
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace lualm {
+	LuaAllocator::LuaAllocator() {
+		AddOwner("<state>", 0, 0);
+	}
+
+	LuaAllocator::~LuaAllocator() {
+		for (void* slab : _slabs) {
+			std::free(slab);
+		}
+	}
+
+	void* LuaAllocator::Alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+		auto& self = *static_cast<LuaAllocator*>(ud);
+		if (self._sampleRate != 0) [[unlikely]] {
+			self.CountSample(ptr, osize, nsize);
+		}
+		return self._tracking ? self.DispatchTracked(ptr, osize, nsize) : self.Dispatch(ptr, osize, nsize);
+	}
+
+	uint32_t LuaAllocator::AddOwner(std::string name, size_t softLimit, size_t hardLimit) {
+		_owners.emplace_back(std::move(name), 0, 0, softLimit, hardLimit, 0, false);
+		return static_cast<uint32_t>(_owners.size() - 1);
+	}
+
+	void LuaAllocator::SetSampling(size_t sampleRate, SampleFunc func, void* data) {
+		_sampleRate = sampleRate;
+		_sampleCountdown = sampleRate;
+		_sampleFunc = func;
+		_sampleData = data;
+	}
+
+	void LuaAllocator::CountSample(void* ptr, size_t osize, size_t nsize) {
+		// For a new block Lua passes the object type in osize
+		const size_t grown = ptr ? (nsize > osize ? nsize - osize : 0) : nsize;
+		if (grown < _sampleCountdown) {
+			_sampleCountdown -= grown;
+			return;
+		}
+		const size_t over = grown - _sampleCountdown;
+		_sampleCountdown = _sampleRate - over % _sampleRate;
+		_sampleFunc(_sampleData, ptr ? -1 : static_cast<int>(osize), grown, 1 + over / _sampleRate);
+	}
+
+	const LuaAllocator::OwnerStats* LuaAllocator::TakeCollectRequest() {
+		const size_t owner = std::exchange(_collectRequest, kNoRequest);
+		return owner != kNoRequest ? &_owners[owner] : nullptr;
+	}
+
+	void* LuaAllocator::Dispatch(void* ptr, size_t osize, size_t nsize) {
+		if (nsize == 0) {
+			if (ptr) {
+				Deallocate(ptr, osize);
+			}
+			return nullptr;
+		}
+		// osize holds the object type tag, not a size, when ptr is null
+		if (!ptr) {
+			return Allocate(nsize);
+		}
+		return Reallocate(ptr, osize, nsize);
+	}
+
+	void* LuaAllocator::DispatchTracked(void* ptr, size_t osize, size_t nsize) {
+		Header* header = ptr ? static_cast<Header*>(ptr) - 1 : nullptr;
+		auto& owner = _owners[header ? header->owner : _owner];
+		const size_t oldSize = ptr ? osize : 0;
+
+		if (nsize == 0) {
+			if (header) {
+				Dispatch(header, osize + kHeaderSize, 0);
+				owner.bytesInUse -= osize;
+				if (owner.bytesInUse <= owner.softLimit) {
+					owner.overSoftLimit = false;
+				}
+			}
+			return nullptr;
+		}
+
+		if (nsize > oldSize && !Admit(owner, nsize - oldSize)) {
+			// Lua runs an emergency collection and retries before raising a memory error
+			return nullptr;
+		}
+
+		void* block = Dispatch(header, header ? osize + kHeaderSize : osize, nsize + kHeaderSize);
+		if (!block) {
+			return nullptr;
+		}
+		if (!header) {
+			new (block) Header{ static_cast<uint32_t>(&owner - _owners.data()) };
+		}
+		owner.bytesInUse = owner.bytesInUse - oldSize + nsize;
+		owner.peakBytes = std::max(owner.peakBytes, owner.bytesInUse);
+		return static_cast<Header*>(block) + 1;
+	}
+
+	bool LuaAllocator::Admit(OwnerStats& owner, size_t growth) {
+		const size_t total = owner.bytesInUse + growth;
+		if (owner.hardLimit != 0 && total > owner.hardLimit && !_limitsSuspended) {
+			++owner.limitFailures;
+			return false;
+		}
+		if (owner.softLimit != 0 && total > owner.softLimit && !owner.overSoftLimit) {
+			owner.overSoftLimit = true;
+			if (_collectRequest == kNoRequest) {
+				_collectRequest = static_cast<size_t>(&owner - _owners.data());
+			}
+		}
+		return true;
+	}
+
+	void* LuaAllocator::Allocate(size_t size) {
+		void* ptr = IsSmall(size) ? AllocateSmall(ClassOf(size)) : std::malloc(size);
+		if (!ptr) {
+			return nullptr;
+		}
+		if (!IsSmall(size)) {
+			_stats.largeBytes += size;
+		}
+		_stats.bytesInUse += size;
+		_stats.peakBytes = std::max(_stats.peakBytes, _stats.bytesInUse);
+		++_stats.allocations;
+		return ptr;
+	}
+
+	void LuaAllocator::Deallocate(void* ptr, size_t size) {
+		if (IsSmall(size)) {
+			DeallocateSmall(ptr, ClassOf(size));
+		} else {
+			std::free(ptr);
+			_stats.largeBytes -= size;
+		}
+		_stats.bytesInUse -= size;
+		++_stats.frees;
+	}
+
+	void* LuaAllocator::Reallocate(void* ptr, size_t osize, size_t nsize) {
+		if (IsSmall(osize) && IsSmall(nsize)) {
+			if (ClassOf(osize) == ClassOf(nsize)) {
+				_stats.bytesInUse = _stats.bytesInUse - osize + nsize;
+				_stats.peakBytes = std::max(_stats.peakBytes, _stats.bytesInUse);
+				return ptr;
+			}
+		} else if (!IsSmall(osize) && !IsSmall(nsize)) {
+			void* block = std::realloc(ptr, nsize);
+			if (!block) {
+				return nullptr;
+			}
+			_stats.largeBytes = _stats.largeBytes - osize + nsize;
+			_stats.bytesInUse = _stats.bytesInUse - osize + nsize;
+			_stats.peakBytes = std::max(_stats.peakBytes, _stats.bytesInUse);
+			return block;
+		}
+
+		// Crossing a size class or the small/large boundary
+		void* block = Allocate(nsize);
+		if (!block) {
+			return nullptr;
+		}
+		std::memcpy(block, ptr, std::min(osize, nsize));
+		Deallocate(ptr, osize);
+		return block;
+	}
+
+	void* LuaAllocator::AllocateSmall(size_t cls) {
+		auto& [head, cursor, end] = _classes[cls];
+		if (head) {
+			FreeBlock* block = head;
+			head = block->next;
+			return block;
+		}
+
+		const size_t blockSize = (cls + 1) * kGranularity;
+		if (cursor == end) {
+			auto* slab = static_cast<std::byte*>(std::malloc(kSlabSize));
+			if (!slab) {
+				return nullptr;
+			}
+			_slabs.push_back(slab);
+			_stats.slabBytes += kSlabSize;
+			cursor = slab;
+			// Drop the tail that cannot hold a whole block
+			end = slab + kSlabSize - kSlabSize % blockSize;
+		}
+
+		void* block = cursor;
+		cursor += blockSize;
+		return block;
+	}
+
+	void LuaAllocator::DeallocateSmall(void* ptr, size_t cls) {
+		auto& head = _classes[cls].free;
+		head = new (ptr) FreeBlock{ head };
+	}
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lualm {
+	// lua_Alloc backend for one Lua state. Blocks up to kMaxSmallSize are
+	// served from per-size-class free lists carved out of slabs, which covers
+	// most strings, tables, closures and CallInfo records. Bigger blocks go to
+	// the system allocator. Lua always reports the old block size, so blocks
+	// carry no header. A state is single-threaded, so nothing is locked.
+	//
+	// With tracking enabled every block gets a small header naming the owner
+	// that allocated it, so usage can be attributed to the plugin whose code
+	// was running and checked against per-owner limits. Owner 0 is the state
+	// itself (libraries, modules) and is never limited.
+	//
+	// With sampling enabled every sampleRate-th allocated byte reports the
+	// allocation that contains it, so large and frequent allocations are seen
+	// in proportion to the bytes they take.
+	class LuaAllocator {
+	public:
+		static constexpr size_t kGranularity = 16;
+		static constexpr size_t kMaxSmallSize = 512;
+		static constexpr size_t kClassCount = kMaxSmallSize / kGranularity;
+		static constexpr size_t kSlabSize = 64 * 1024;
+
+		static constexpr size_t kHeaderSize = kGranularity;
+
+		struct OwnerStats {
+			std::string name;
+			size_t bytesInUse;
+			size_t peakBytes;
+			size_t softLimit; // 0 for none, crossing it requests a full collection
+			size_t hardLimit; // 0 for none, growth past it fails the allocation
+			size_t limitFailures;
+			bool overSoftLimit;
+		};
+
+		struct Stats {
+			size_t bytesInUse;
+			size_t peakBytes;
+			size_t slabBytes;
+			size_t largeBytes;
+			size_t allocations;
+			size_t frees;
+		};
+
+		LuaAllocator();
+		~LuaAllocator();
+		LuaAllocator(const LuaAllocator&) = delete;
+		LuaAllocator& operator=(const LuaAllocator&) = delete;
+
+		// Matches lua_Alloc, ud must point to a LuaAllocator
+		static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+		const Stats& GetStats() const { return _stats; }
+
+		// Must be set before the state is created
+		void SetTracking(bool enable) { _tracking = enable; }
+		bool IsTracking() const { return _tracking; }
+
+		uint32_t AddOwner(std::string name, size_t softLimit, size_t hardLimit);
+		uint32_t GetOwner() const { return _owner; }
+		// Returns the previous owner
+		uint32_t SetOwner(uint32_t owner) { return std::exchange(_owner, owner); }
+		const OwnerStats& GetOwnerStats(uint32_t owner) const { return _owners[owner]; }
+
+		// Owner that crossed its soft limit since the last call, if any
+		const OwnerStats* TakeCollectRequest();
+
+		// While suspended, growth is still charged but never refused. The module
+		// suspends limits while it converts values outside a protected call,
+		// where a refused allocation would end in a panic. Returns the previous state.
+		bool SuspendLimits(bool suspend) { return std::exchange(_limitsSuspended, suspend); }
+
+		// kind is the Lua type of a new object, or -1 when a block grows.
+		// samples is how many sample points the allocation covered.
+		using SampleFunc = void (*)(void* data, int kind, size_t size, size_t samples);
+
+		// A rate of 0 turns sampling off
+		void SetSampling(size_t sampleRate, SampleFunc func, void* data);
+
+	private:
+		static constexpr size_t ClassOf(size_t size) { return (size - 1) / kGranularity; }
+		static constexpr bool IsSmall(size_t size) { return size <= kMaxSmallSize; }
+
+		void* Dispatch(void* ptr, size_t osize, size_t nsize);
+		void* DispatchTracked(void* ptr, size_t osize, size_t nsize);
+		bool Admit(OwnerStats& owner, size_t growth);
+		void CountSample(void* ptr, size_t osize, size_t nsize);
+
+		void* Allocate(size_t size);
+		void Deallocate(void* ptr, size_t size);
+		void* Reallocate(void* ptr, size_t osize, size_t nsize);
+		void* AllocateSmall(size_t cls);
+		void DeallocateSmall(void* ptr, size_t cls);
+
+		struct FreeBlock {
+			FreeBlock* next;
+		};
+		struct SizeClass {
+			FreeBlock* free;
+			std::byte* cursor;
+			std::byte* end;
+		};
+		std::array<SizeClass, kClassCount> _classes{};
+		std::vector<void*> _slabs;
+		Stats _stats{};
+		struct alignas(kHeaderSize) Header {
+			uint32_t owner;
+		};
+		std::vector<OwnerStats> _owners;
+		uint32_t _owner{};
+		static constexpr size_t kNoRequest = static_cast<size_t>(-1);
+		size_t _collectRequest{kNoRequest};
+		bool _tracking{false};
+		bool _limitsSuspended{false};
+		size_t _sampleRate{};
+		size_t _sampleCountdown{};
+		SampleFunc _sampleFunc{};
+		void* _sampleData{};
+	};
+}
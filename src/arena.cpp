@@ -0,0 +1,26 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace lualm {
+	void* CallArena::Allocate(size_t size, size_t alignment) {
+		for (;;) {
+			if (_current < _chunks.size()) {
+				auto& [data, capacity] = _chunks[_current];
+				const auto base = reinterpret_cast<uintptr_t>(data.get());
+				const size_t offset = ((base + _offset + alignment - 1) & ~(alignment - 1)) - base;
+				if (offset + size <= capacity) {
+					_offset = offset + size;
+					return data.get() + offset;
+				}
+				++_current;
+				_offset = 0;
+				continue;
+			}
+
+			const size_t capacity = std::max(kChunkSize, size + alignment);
+			_chunks.emplace_back(std::make_unique_for_overwrite<std::byte[]>(capacity), capacity);
+		}
+	}
+}
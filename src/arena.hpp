@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace lualm {
+	// Bump allocator for per-call marshalling frames. Chunks are kept
+	// between calls, so a steady state never touches the heap. Frames are
+	// released in LIFO order by rewinding to a mark, which keeps re-entrant
+	// calls (native -> Lua -> native) safe.
+	class CallArena {
+	public:
+		static constexpr size_t kChunkSize = 16 * 1024;
+
+		struct Mark {
+			size_t chunk;
+			size_t offset;
+		};
+
+		Mark GetMark() const { return { _current, _offset }; }
+		void Rewind(Mark mark) { _current = mark.chunk; _offset = mark.offset; }
+
+		void* Allocate(size_t size, size_t alignment);
+
+	private:
+		struct Chunk {
+			std::unique_ptr<std::byte[]> data;
+			size_t size;
+		};
+		std::vector<Chunk> _chunks;
+		size_t _current{};
+		size_t _offset{};
+	};
+}
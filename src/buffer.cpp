@@ -0,0 +1,253 @@
+#include "buffer.hpp"
+
+#include <algorithm>
+#include <format>
+#include <limits>
+#include <string>
+#include <string_view>
+
+namespace lualm {
+	namespace {
+		template<typename T>
+		struct ElementName;
+
+		template<> struct ElementName<int8_t> { static constexpr std::string_view kValue = "int8"; };
+		template<> struct ElementName<int16_t> { static constexpr std::string_view kValue = "int16"; };
+		template<> struct ElementName<int32_t> { static constexpr std::string_view kValue = "int32"; };
+		template<> struct ElementName<int64_t> { static constexpr std::string_view kValue = "int64"; };
+		template<> struct ElementName<uint8_t> { static constexpr std::string_view kValue = "uint8"; };
+		template<> struct ElementName<uint16_t> { static constexpr std::string_view kValue = "uint16"; };
+		template<> struct ElementName<uint32_t> { static constexpr std::string_view kValue = "uint32"; };
+		template<> struct ElementName<uint64_t> { static constexpr std::string_view kValue = "uint64"; };
+		template<> struct ElementName<float> { static constexpr std::string_view kValue = "float"; };
+		template<> struct ElementName<double> { static constexpr std::string_view kValue = "double"; };
+
+		template<typename T>
+		plg::vector<T>* CheckBuffer(lua_State* L, int arg) {
+			return static_cast<plg::vector<T>*>(luaL_checkudata(L, arg, BufferTraits<T>::kName));
+		}
+
+		// Same conversion rules as ValueFromObject for numeric parameters
+		template<typename T>
+		T CheckElement(lua_State* L, int arg) {
+			if constexpr (std::is_floating_point_v<T>) {
+				return static_cast<T>(luaL_checknumber(L, arg));
+			} else {
+				if (!lua_isinteger(L, arg)) {
+					luaL_typeerror(L, arg, "integer");
+				}
+				const lua_Integer value = lua_tointeger(L, arg);
+				if constexpr (std::is_signed_v<T>) {
+					if (value < static_cast<lua_Integer>(std::numeric_limits<T>::min()) || value > static_cast<lua_Integer>(std::numeric_limits<T>::max())) {
+						luaL_argerror(L, arg, "overflow error");
+					}
+				} else if constexpr (sizeof(T) < sizeof(lua_Integer)) {
+					if (static_cast<lua_Unsigned>(value) > std::numeric_limits<T>::max()) {
+						luaL_argerror(L, arg, "overflow error");
+					}
+				}
+				return static_cast<T>(value);
+			}
+		}
+
+		template<typename T>
+		void PushElement(lua_State* L, T value) {
+			if constexpr (std::is_floating_point_v<T>) {
+				lua_pushnumber(L, static_cast<lua_Number>(value));
+			} else {
+				lua_pushinteger(L, static_cast<lua_Integer>(value));
+			}
+		}
+
+		// Buffer.new(type, sizeOrTable): zero-filled of the given size, or a copy of an array table
+		template<typename T>
+		int BufferNew(lua_State* L, int arg) {
+			plg::vector<T> data;
+			if (lua_istable(L, arg)) {
+				const lua_Unsigned len = lua_rawlen(L, arg);
+				data.resize(static_cast<size_t>(len));
+				for (lua_Unsigned i = 0; i < len; ++i) {
+					lua_rawgeti(L, arg, static_cast<lua_Integer>(i + 1));
+					data[static_cast<size_t>(i)] = CheckElement<T>(L, -1);
+					lua_pop(L, 1);
+				}
+			} else {
+				const lua_Integer size = luaL_optinteger(L, arg, 0);
+				luaL_argcheck(L, size >= 0, arg, "size must be non-negative");
+				data.resize(static_cast<size_t>(size));
+			}
+			PushBuffer(L, std::move(data));
+			return 1;
+		}
+
+		template<typename T>
+		int BufferIndex(lua_State* L) {
+			const auto& data = *CheckBuffer<T>(L, 1);
+			if (lua_isinteger(L, 2)) {
+				const lua_Integer index = lua_tointeger(L, 2);
+				if (index >= 1 && static_cast<lua_Unsigned>(index) <= data.size()) {
+					PushElement(L, data[static_cast<size_t>(index - 1)]);
+				} else {
+					lua_pushnil(L);
+				}
+				return 1;
+			}
+			lua_pushvalue(L, 2);
+			lua_rawget(L, lua_upvalueindex(1));
+			return 1;
+		}
+
+		// Writing one past the end appends, like a sequence table
+		template<typename T>
+		int BufferNewIndex(lua_State* L) {
+			auto& data = *CheckBuffer<T>(L, 1);
+			if (!lua_isinteger(L, 2)) {
+				return luaL_error(L, "%s only accepts integer keys", BufferTraits<T>::kName);
+			}
+			const lua_Integer index = lua_tointeger(L, 2);
+			const T value = CheckElement<T>(L, 3);
+			if (index >= 1 && static_cast<lua_Unsigned>(index) <= data.size()) {
+				data[static_cast<size_t>(index - 1)] = value;
+			} else if (index >= 1 && static_cast<lua_Unsigned>(index) == data.size() + 1) {
+				data.push_back(value);
+			} else {
+				return luaL_error(L, "%s index %I out of range [1, %I]", BufferTraits<T>::kName, index, static_cast<lua_Integer>(data.size() + 1));
+			}
+			return 0;
+		}
+
+		template<typename T>
+		int BufferLen(lua_State* L) {
+			lua_pushinteger(L, static_cast<lua_Integer>(CheckBuffer<T>(L, 1)->size()));
+			return 1;
+		}
+
+		template<typename T>
+		int BufferGC(lua_State* L) {
+			// Release the storage but leave a valid empty vector behind,
+			// in case the object is resurrected by another finalizer
+			plg::vector<T>().swap(*CheckBuffer<T>(L, 1));
+			return 0;
+		}
+
+		template<typename T>
+		int BufferToString(lua_State* L) {
+			const auto& data = *CheckBuffer<T>(L, 1);
+			const std::string str = std::format("{}({})", BufferTraits<T>::kName, data.size());
+			lua_pushlstring(L, str.data(), str.size());
+			return 1;
+		}
+
+		template<typename T>
+		int BufferResize(lua_State* L) {
+			auto& data = *CheckBuffer<T>(L, 1);
+			const lua_Integer size = luaL_checkinteger(L, 2);
+			luaL_argcheck(L, size >= 0, 2, "size must be non-negative");
+			data.resize(static_cast<size_t>(size));
+			return 0;
+		}
+
+		template<typename T>
+		int BufferClear(lua_State* L) {
+			CheckBuffer<T>(L, 1)->clear();
+			return 0;
+		}
+
+		template<typename T>
+		int BufferToTable(lua_State* L) {
+			const auto& data = *CheckBuffer<T>(L, 1);
+			const size_t size = data.size();
+			lua_createtable(L, static_cast<int>(std::min<size_t>(size, std::numeric_limits<int>::max())), 0);
+			for (size_t i = 0; i < size; ++i) {
+				PushElement(L, data[i]);
+				lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+			}
+			return 1;
+		}
+
+		template<typename T>
+		int BufferType(lua_State* L) {
+			CheckBuffer<T>(L, 1);
+			lua_pushlstring(L, ElementName<T>::kValue.data(), ElementName<T>::kValue.size());
+			return 1;
+		}
+
+		template<typename T>
+		void RegisterBuffer(lua_State* L) {
+			static const luaL_Reg metamethods[] = {
+				{"__newindex", BufferNewIndex<T>},
+				{"__len", BufferLen<T>},
+				{"__gc", BufferGC<T>},
+				{"__tostring", BufferToString<T>},
+				{nullptr, nullptr}
+			};
+			static const luaL_Reg methods[] = {
+				{"resize", BufferResize<T>},
+				{"clear", BufferClear<T>},
+				{"totable", BufferToTable<T>},
+				{"type", BufferType<T>},
+				{nullptr, nullptr}
+			};
+
+			luaL_newmetatable(L, BufferTraits<T>::kName); // Stack: mt
+			lua_pushstring(L, BufferTraits<T>::kName);
+			lua_setfield(L, -2, "__type");
+			luaL_setfuncs(L, metamethods, 0);
+
+			lua_newtable(L); // Stack: mt, methods
+			luaL_setfuncs(L, methods, 0);
+			lua_pushcclosure(L, BufferIndex<T>, 1); // Stack: mt, __index
+			lua_setfield(L, -2, "__index");
+
+			lua_pop(L, 1);
+		}
+
+		template<typename T>
+		bool TryBufferNew(lua_State* L, std::string_view type, int& result) {
+			if (type != ElementName<T>::kValue) {
+				return false;
+			}
+			result = BufferNew<T>(L, 2);
+			return true;
+		}
+
+		int BufferNewAny(lua_State* L) {
+			size_t length{};
+			const char* str = luaL_checklstring(L, 1, &length);
+			const std::string_view type(str, length);
+
+			int result = 0;
+			if (TryBufferNew<int8_t>(L, type, result) ||
+				TryBufferNew<int16_t>(L, type, result) ||
+				TryBufferNew<int32_t>(L, type, result) ||
+				TryBufferNew<int64_t>(L, type, result) ||
+				TryBufferNew<uint8_t>(L, type, result) ||
+				TryBufferNew<uint16_t>(L, type, result) ||
+				TryBufferNew<uint32_t>(L, type, result) ||
+				TryBufferNew<uint64_t>(L, type, result) ||
+				TryBufferNew<float>(L, type, result) ||
+				TryBufferNew<double>(L, type, result)) {
+				return result;
+			}
+			return luaL_argerror(L, 1, "unknown buffer element type");
+		}
+	}
+
+	int OpenBufferLib(lua_State* L) {
+		RegisterBuffer<int8_t>(L);
+		RegisterBuffer<int16_t>(L);
+		RegisterBuffer<int32_t>(L);
+		RegisterBuffer<int64_t>(L);
+		RegisterBuffer<uint8_t>(L);
+		RegisterBuffer<uint16_t>(L);
+		RegisterBuffer<uint32_t>(L);
+		RegisterBuffer<uint64_t>(L);
+		RegisterBuffer<float>(L);
+		RegisterBuffer<double>(L);
+
+		lua_createtable(L, 0, 1);
+		lua_pushcfunction(L, BufferNewAny);
+		lua_setfield(L, -2, "new");
+		return 1;
+	}
+}
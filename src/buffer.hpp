@@ -0,0 +1,88 @@
+#pragma once
+
+#include <plg/any.hpp>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <cstdint>
+#include <memory>
+
+namespace lualm {
+	// plugify.Buffer<T> is a full userdata owning a plg::vector<T>. It can be
+	// handed to native functions expecting an array of T without building a
+	// Lua table, and array results can be returned as buffers on request.
+	template<typename T>
+	struct BufferTraits;
+
+	template<>
+	struct BufferTraits<int8_t> {
+		static constexpr const char* kName = "plugify.Buffer<int8>";
+	};
+
+	template<>
+	struct BufferTraits<int16_t> {
+		static constexpr const char* kName = "plugify.Buffer<int16>";
+	};
+
+	template<>
+	struct BufferTraits<int32_t> {
+		static constexpr const char* kName = "plugify.Buffer<int32>";
+	};
+
+	template<>
+	struct BufferTraits<int64_t> {
+		static constexpr const char* kName = "plugify.Buffer<int64>";
+	};
+
+	template<>
+	struct BufferTraits<uint8_t> {
+		static constexpr const char* kName = "plugify.Buffer<uint8>";
+	};
+
+	template<>
+	struct BufferTraits<uint16_t> {
+		static constexpr const char* kName = "plugify.Buffer<uint16>";
+	};
+
+	template<>
+	struct BufferTraits<uint32_t> {
+		static constexpr const char* kName = "plugify.Buffer<uint32>";
+	};
+
+	template<>
+	struct BufferTraits<uint64_t> {
+		static constexpr const char* kName = "plugify.Buffer<uint64>";
+	};
+
+	template<>
+	struct BufferTraits<float> {
+		static constexpr const char* kName = "plugify.Buffer<float>";
+	};
+
+	template<>
+	struct BufferTraits<double> {
+		static constexpr const char* kName = "plugify.Buffer<double>";
+	};
+
+	template<typename T>
+	constexpr bool is_buffer_element_v = requires { BufferTraits<T>::kName; };
+
+	template<typename T>
+	plg::vector<T>* TestBuffer(lua_State* L, int arg) {
+		return static_cast<plg::vector<T>*>(luaL_testudata(L, arg, BufferTraits<T>::kName));
+	}
+
+	// Pushes a new buffer taking over the storage of value
+	template<typename T>
+	plg::vector<T>* PushBuffer(lua_State* L, plg::vector<T>&& value) {
+		auto* buffer = static_cast<plg::vector<T>*>(lua_newuserdatauv(L, sizeof(plg::vector<T>), 0));
+		std::construct_at(buffer, std::move(value));
+		luaL_setmetatable(L, BufferTraits<T>::kName);
+		return buffer;
+	}
+
+	// Opens the buffer library: registers one metatable per element type and
+	// returns the Buffer table with the new(type, sizeOrTable) constructor.
+	int OpenBufferLib(lua_State* L);
+}
@@ -0,0 +1,255 @@
+#include "cache.hpp"
+
+#include <plg/format.hpp>
+
+#include <lauxlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+namespace lualm {
+	namespace {
+		constexpr char kMagic[8] = { 'L', 'U', 'A', 'L', 'M', 'B', 'C', '1' };
+
+		// FNV-1a, only used to detect changes, not for security
+		uint64_t Hash(std::string_view data, uint64_t hash = 0xcbf29ce484222325ULL) {
+			for (const char c : data) {
+				hash ^= static_cast<unsigned char>(c);
+				hash *= 0x100000001b3ULL;
+			}
+			return hash;
+		}
+
+		bool ReadFile(const fs::path& path, std::string& data) {
+			std::ifstream file(path, std::ios::binary);
+			if (!file) {
+				return false;
+			}
+			data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			return !file.bad();
+		}
+
+		template<typename T>
+		void Append(std::string& out, const T& value) {
+			out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		template<typename T>
+		bool Extract(std::string_view& in, T& value) {
+			if (in.size() < sizeof(T)) {
+				return false;
+			}
+			std::memcpy(&value, in.data(), sizeof(T));
+			in.remove_prefix(sizeof(T));
+			return true;
+		}
+
+		int Writer(lua_State*, const void* p, size_t sz, void* ud) {
+			static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+			return 0;
+		}
+
+	}
+
+	BytecodeCache::BytecodeCache(fs::path directory, std::string version)
+		: _directory(std::move(directory))
+		, _version(std::format("{}|{}", LUA_VERSION_RELEASE, version)) {
+	}
+
+	BytecodeCache::~BytecodeCache() {
+		for (auto& worker : _workers) {
+			worker.request_stop();
+		}
+		_workers.clear(); // Joins
+	}
+
+	int BytecodeCache::Load(lua_State* L, const char* filename) {
+		WaitFor(filename);
+
+		Entry entry;
+		if (!Prepare(filename, entry)) {
+			return luaL_loadfile(L, filename);
+		}
+
+		const std::string chunkname = std::format("@{}", filename);
+
+		std::string chunk;
+		if (Read(entry, chunk)) {
+			if (luaL_loadbufferx(L, chunk.data(), chunk.size(), chunkname.c_str(), "b") == LUA_OK) {
+				return LUA_OK;
+			}
+			lua_pop(L, 1); // Foreign or damaged chunk, recompile
+		}
+
+		const int status = luaL_loadbufferx(L, entry.source.data(), entry.source.size(), chunkname.c_str(), "t");
+		if (status == LUA_OK && Dump(L, chunk)) {
+			Write(entry, chunk);
+		}
+		return status;
+	}
+
+	void BytecodeCache::Precompile(std::vector<fs::path> sources, size_t threads) {
+		_jobs.reserve(sources.size());
+		for (auto& source : sources) {
+			auto& job = _jobs.emplace_back(std::make_unique<Job>());
+			job->source = std::move(source);
+			_jobsBySource.emplace(GetJobKey(job->source), job.get());
+		}
+
+		threads = std::min(threads, _jobs.size());
+		_workers.reserve(threads);
+		for (size_t i = 0; i < threads; ++i) {
+			_workers.emplace_back([this](std::stop_token token) { Work(std::move(token)); });
+		}
+	}
+
+	std::string BytecodeCache::GetJobKey(const fs::path& source) {
+		std::error_code ec;
+		const fs::path absolute = fs::absolute(source, ec);
+		return (ec ? source : absolute).lexically_normal().string();
+	}
+
+	void BytecodeCache::Work(std::stop_token token) {
+		lua_State* L = luaL_newstate();
+		if (!L) {
+			return;
+		}
+
+		for (size_t i = _nextJob++; i < _jobs.size() && !token.stop_requested(); i = _nextJob++) {
+			auto& job = *_jobs[i];
+			auto expected = JobState::Queued;
+			if (!job.state.compare_exchange_strong(expected, JobState::Running)) {
+				continue; // Taken over by Load
+			}
+
+			Compile(L, job.source);
+
+			{
+				std::lock_guard lock(_mutex);
+				job.state = JobState::Done;
+			}
+			_jobDone.notify_all();
+		}
+
+		lua_close(L);
+	}
+
+	void BytecodeCache::Compile(lua_State* L, const fs::path& source) const {
+		Entry entry;
+		std::string chunk;
+		if (!Prepare(source, entry) || Read(entry, chunk)) {
+			return;
+		}
+
+		const std::string chunkname = std::format("@{}", source.string());
+		if (luaL_loadbufferx(L, entry.source.data(), entry.source.size(), chunkname.c_str(), "t") == LUA_OK && Dump(L, chunk)) {
+			Write(entry, chunk);
+		}
+		lua_settop(L, 0);
+	}
+
+	void BytecodeCache::WaitFor(const fs::path& source) {
+		if (_jobsBySource.empty()) {
+			return;
+		}
+
+		const auto it = _jobsBySource.find(GetJobKey(source));
+		if (it == _jobsBySource.end()) {
+			return;
+		}
+
+		auto& job = *it->second;
+		auto expected = JobState::Queued;
+		if (job.state.compare_exchange_strong(expected, JobState::Done)) {
+			return; // Not reached by a worker yet, the caller compiles it
+		}
+
+		std::unique_lock lock(_mutex);
+		_jobDone.wait(lock, [&job] { return job.state == JobState::Done; });
+	}
+
+	bool BytecodeCache::Prepare(const fs::path& source, Entry& entry) const {
+		if (!ReadFile(source, entry.source)) {
+			return false;
+		}
+		// Skip the shebang line like luaL_loadfile does
+		if (entry.source.starts_with('#')) {
+			entry.source.replace(0, entry.source.find('\n'), "--");
+		}
+
+		std::error_code ec;
+		const fs::path absolute = fs::absolute(source, ec);
+		const uint64_t pathHash = Hash((ec ? source : absolute).string());
+		entry.path = _directory / std::format("{:016x}.luac", pathHash);
+		entry.sourceHash = Hash(entry.source);
+		return true;
+	}
+
+	bool BytecodeCache::Read(const Entry& entry, std::string& chunk) const {
+		std::string data;
+		if (!ReadFile(entry.path, data)) {
+			return false;
+		}
+
+		std::string_view in(data);
+		char magic[sizeof(kMagic)];
+		uint64_t versionHash{}, sourceHash{}, chunkHash{}, chunkSize{};
+		if (!Extract(in, magic) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+			!Extract(in, versionHash) || versionHash != Hash(_version) ||
+			!Extract(in, sourceHash) || sourceHash != entry.sourceHash ||
+			!Extract(in, chunkHash) || !Extract(in, chunkSize) ||
+			chunkSize != in.size() || chunkHash != Hash(in)) {
+			return false;
+		}
+
+		chunk.assign(in);
+		return true;
+	}
+
+	void BytecodeCache::Write(const Entry& entry, std::string_view chunk) const {
+		static std::atomic<uint32_t> counter;
+
+		std::string data;
+		data.reserve(sizeof(kMagic) + 4 * sizeof(uint64_t) + chunk.size());
+		data.append(kMagic, sizeof(kMagic));
+		Append(data, Hash(_version));
+		Append(data, entry.sourceHash);
+		Append(data, Hash(chunk));
+		Append(data, static_cast<uint64_t>(chunk.size()));
+		data.append(chunk);
+
+		std::error_code ec;
+		fs::create_directories(_directory, ec);
+		if (ec) {
+			return;
+		}
+
+		fs::path temp = entry.path;
+		// Unique across threads and, in practice, across processes sharing the cache
+		const auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+		temp += std::format(".{:x}.{}.tmp", stamp, counter.fetch_add(1, std::memory_order_relaxed));
+		{
+			std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+			if (!file.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+				file.close();
+				fs::remove(temp, ec);
+				return;
+			}
+		}
+
+		fs::rename(temp, entry.path, ec);
+		if (ec) {
+			fs::remove(temp, ec);
+		}
+	}
+
+	bool BytecodeCache::Dump(lua_State* L, std::string& chunk) {
+		chunk.clear();
+		return lua_dump(L, &Writer, &chunk, 0) == 0;
+	}
+}
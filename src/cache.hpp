@@ -0,0 +1,77 @@
+#pragma once
+
+#include <lua.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lualm {
+	// Compiled chunks of script files, stored as <dir>/<path hash>.luac. Each
+	// entry carries the Lua release, the module version and a hash of the
+	// source it came from, and is ignored unless all three match, so an edited
+	// script or an upgrade simply recompiles. Entries are written to a temporary
+	// file and renamed into place, which keeps concurrent writers safe.
+	//
+	// Precompile fills the cache from a worker pool, each worker compiling
+	// with its own throwaway state. Load waits for a file a worker is busy
+	// with and takes over files no worker has reached yet.
+	class BytecodeCache {
+	public:
+		BytecodeCache(std::filesystem::path directory, std::string version);
+		~BytecodeCache();
+		BytecodeCache(const BytecodeCache&) = delete;
+		BytecodeCache& operator=(const BytecodeCache&) = delete;
+
+		// Same contract as luaL_loadfile, but skips parsing on a valid entry
+		int Load(lua_State* L, const char* filename);
+
+		// Starts compiling sources in the background, call at most once
+		void Precompile(std::vector<std::filesystem::path> sources, size_t threads);
+
+	private:
+		struct Entry {
+			std::filesystem::path path;
+			std::string source;
+			uint64_t sourceHash;
+		};
+
+		bool Prepare(const std::filesystem::path& source, Entry& entry) const;
+		bool Read(const Entry& entry, std::string& chunk) const;
+		void Write(const Entry& entry, std::string_view chunk) const;
+		static bool Dump(lua_State* L, std::string& chunk);
+
+		enum class JobState : uint8_t {
+			Queued,
+			Running,
+			Done
+		};
+		struct Job {
+			std::filesystem::path source;
+			std::atomic<JobState> state{JobState::Queued};
+		};
+
+		static std::string GetJobKey(const std::filesystem::path& source);
+		void Work(std::stop_token token);
+		void Compile(lua_State* L, const std::filesystem::path& source) const;
+		void WaitFor(const std::filesystem::path& source);
+
+		std::filesystem::path _directory;
+		std::string _version;
+		// Fixed once Precompile returns, only job states change afterwards
+		std::vector<std::unique_ptr<Job>> _jobs;
+		std::unordered_map<std::string, Job*> _jobsBySource;
+		std::atomic<size_t> _nextJob{};
+		std::mutex _mutex;
+		std::condition_variable _jobDone;
+		std::vector<std::jthread> _workers;
+	};
+}
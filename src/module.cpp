@@ -1,7 +1,14 @@
 #include "module.hpp"
+#include "vector.hpp"
+#include "buffer.hpp"
 #include <bitset>
+#include <charconv>
+#include <limits>
 #include <filesystem>
+#include <cstdlib>
 #include <exception>
+#include <fstream>
+#include <thread>
 
 #include <plg/string.hpp>
 #include <plg/any.hpp>
@@ -16,6 +23,97 @@ namespace lualm {
 	extern LuaLanguageModule g_lualm;
 
 	namespace {
+		// Settings are read once in Initialize, see the README for the full list
+		void WarnEnv(const char* name, std::string_view value, std::string_view expected) {
+			g_lualm.GetLogger()->Log(std::format(LOG_PREFIX "Ignoring {}='{}', expected {}", name, value, expected), Severity::Warning);
+		}
+
+		bool GetEnvFlag(const char* name, bool fallback = false) {
+			const char* value = std::getenv(name);
+			if (!value) {
+				return fallback;
+			}
+			const std::string_view flag(value);
+			if (flag == "1" || flag == "true" || flag == "on") {
+				return true;
+			}
+			if (flag == "0" || flag == "false" || flag == "off") {
+				return false;
+			}
+			WarnEnv(name, flag, "1/true/on or 0/false/off");
+			return fallback;
+		}
+
+		// Byte count with an optional K, M or G suffix, 0 when unset or malformed
+		size_t GetEnvSize(const char* name) {
+			const char* value = std::getenv(name);
+			if (!value) {
+				return 0;
+			}
+			const std::string_view text(value);
+			size_t size = 0;
+			const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), size);
+			const std::string_view suffix(ptr, text.data() + text.size());
+			if (ec != std::errc{} || suffix.size() > 1) {
+				WarnEnv(name, text, "a number with an optional K, M or G suffix");
+				return 0;
+			}
+			int shift;
+			switch (suffix.empty() ? '\0' : suffix.front()) {
+				case '\0': shift = 0; break;
+				case 'G': case 'g': shift = 30; break;
+				case 'M': case 'm': shift = 20; break;
+				case 'K': case 'k': shift = 10; break;
+				default:
+					WarnEnv(name, text, "a number with an optional K, M or G suffix");
+					return 0;
+			}
+			if (size > (SIZE_MAX >> shift)) {
+				WarnEnv(name, text, "a size that fits in memory");
+				return 0;
+			}
+			return size << shift;
+		}
+
+		// With paced collection the automatic collector waits for the heap to
+		// quadruple, and OnUpdate starts a cycle once it has grown by half
+		constexpr int kPacedPause = 400;
+		constexpr size_t kIdlePause = 150;
+
+		size_t GetHeapSize(lua_State* L) {
+			return static_cast<size_t>(lua_gc(L, LUA_GCCOUNT)) * 1024 + static_cast<size_t>(lua_gc(L, LUA_GCCOUNTB));
+		}
+
+		// Stops the automatic collector of a paced state while the host runs Lua
+		// code, so collection work lands in the OnUpdate budget rather than in
+		// the middle of a callback. A heap that outgrew the paced pause is not
+		// held, the collector has to catch up then. Nested entries share the
+		// outermost hold, and a collector stopped by the script stays stopped.
+		class CollectorHold {
+		public:
+			CollectorHold(LuaContext& context, bool paced) : _context(paced ? &context : nullptr) {
+				if (!_context || context.gcHolds++ != 0) {
+					return;
+				}
+				lua_State* L = context.L;
+				if (lua_gc(L, LUA_GCISRUNNING) && GetHeapSize(L) * 100 < context.gcBaseline * kPacedPause) {
+					lua_gc(L, LUA_GCSTOP);
+					context.gcHeld = true;
+				}
+			}
+			~CollectorHold() {
+				if (_context && --_context->gcHolds == 0 && _context->gcHeld) {
+					_context->gcHeld = false;
+					lua_gc(_context->L, LUA_GCRESTART);
+				}
+			}
+			CollectorHold(const CollectorHold&) = delete;
+			CollectorHold& operator=(const CollectorHold&) = delete;
+
+		private:
+			LuaContext* _context;
+		};
+
 		void ReplaceAll(std::string& str, const std::string& from, const std::string& to) {
 			size_t start_pos{};
 			while ((start_pos = str.find(from, start_pos)) != std::string::npos) {
@@ -68,6 +166,88 @@ namespace lualm {
 				std::is_same_v<T, plg::function> ||
 				std::is_same_v<T, plg::any>;
 
+		// Element types that map onto a plain Lua integer or float
+		template<class T>
+		constexpr bool is_lua_integer_v =
+				std::is_integral_v<T> &&
+				!std::is_same_v<T, bool> &&
+				!std::is_same_v<T, char> &&
+				!std::is_same_v<T, char16_t>;
+
+		template<class T>
+		constexpr bool is_lua_number_v = std::is_floating_point_v<T>;
+
+		template<class T>
+		struct is_plg_vector : std::false_type {};
+
+		template<class T>
+		struct is_plg_vector<plg::vector<T>> : std::true_type {};
+
+		template<class T>
+		constexpr bool is_plg_vector_v = is_plg_vector<T>::value;
+
+		// Arrays that may travel as a plugify.Buffer userdata
+		template<class T>
+		constexpr bool is_buffer_vector_v = false;
+
+		template<class T>
+		constexpr bool is_buffer_vector_v<plg::vector<T>> = is_buffer_element_v<T>;
+
+		// Types that travel in a register rather than through a pointer to storage
+		template<class T>
+		constexpr bool IsPassedByValue() {
+			return std::is_arithmetic_v<T> || std::is_pointer_v<T>;
+		}
+
+		// Invokes f.template operator()<T>() with the C++ type backing a value type.
+		// Void and Function have no storage type and yield a value-initialized result.
+		template<typename F>
+		auto VisitValueType(ValueType type, F&& f) -> decltype(f.template operator()<bool>()) {
+			switch (type) {
+				case ValueType::Bool: return f.template operator()<bool>();
+				case ValueType::Char8: return f.template operator()<char>();
+				case ValueType::Char16: return f.template operator()<char16_t>();
+				case ValueType::Int8: return f.template operator()<int8_t>();
+				case ValueType::Int16: return f.template operator()<int16_t>();
+				case ValueType::Int32: return f.template operator()<int32_t>();
+				case ValueType::Int64: return f.template operator()<int64_t>();
+				case ValueType::UInt8: return f.template operator()<uint8_t>();
+				case ValueType::UInt16: return f.template operator()<uint16_t>();
+				case ValueType::UInt32: return f.template operator()<uint32_t>();
+				case ValueType::UInt64: return f.template operator()<uint64_t>();
+				case ValueType::Pointer: return f.template operator()<void*>();
+				case ValueType::Float: return f.template operator()<float>();
+				case ValueType::Double: return f.template operator()<double>();
+				case ValueType::String: return f.template operator()<plg::string>();
+				case ValueType::Any: return f.template operator()<plg::any>();
+				case ValueType::ArrayBool: return f.template operator()<plg::vector<bool>>();
+				case ValueType::ArrayChar8: return f.template operator()<plg::vector<char>>();
+				case ValueType::ArrayChar16: return f.template operator()<plg::vector<char16_t>>();
+				case ValueType::ArrayInt8: return f.template operator()<plg::vector<int8_t>>();
+				case ValueType::ArrayInt16: return f.template operator()<plg::vector<int16_t>>();
+				case ValueType::ArrayInt32: return f.template operator()<plg::vector<int32_t>>();
+				case ValueType::ArrayInt64: return f.template operator()<plg::vector<int64_t>>();
+				case ValueType::ArrayUInt8: return f.template operator()<plg::vector<uint8_t>>();
+				case ValueType::ArrayUInt16: return f.template operator()<plg::vector<uint16_t>>();
+				case ValueType::ArrayUInt32: return f.template operator()<plg::vector<uint32_t>>();
+				case ValueType::ArrayUInt64: return f.template operator()<plg::vector<uint64_t>>();
+				case ValueType::ArrayPointer: return f.template operator()<plg::vector<void*>>();
+				case ValueType::ArrayFloat: return f.template operator()<plg::vector<float>>();
+				case ValueType::ArrayDouble: return f.template operator()<plg::vector<double>>();
+				case ValueType::ArrayString: return f.template operator()<plg::vector<plg::string>>();
+				case ValueType::ArrayAny: return f.template operator()<plg::vector<plg::any>>();
+				case ValueType::ArrayVector2: return f.template operator()<plg::vector<plg::vec2>>();
+				case ValueType::ArrayVector3: return f.template operator()<plg::vector<plg::vec3>>();
+				case ValueType::ArrayVector4: return f.template operator()<plg::vector<plg::vec4>>();
+				case ValueType::ArrayMatrix4x4: return f.template operator()<plg::vector<plg::mat4x4>>();
+				case ValueType::Vector2: return f.template operator()<plg::vec2>();
+				case ValueType::Vector3: return f.template operator()<plg::vec3>();
+				case ValueType::Vector4: return f.template operator()<plg::vec4>();
+				case ValueType::Matrix4x4: return f.template operator()<plg::mat4x4>();
+				default: return {};
+			}
+		}
+
 		// Return codes:
 		// [1, 3]	Number bytes used
 		// 0		Sequence starts with \0
@@ -173,28 +353,304 @@ namespace lualm {
 			void InternalCall(const Method* method, Address data, uint64_t* params, size_t count, void* ret) {
 				g_lualm.InternalCall(*method, data, params, count, ret);
 			}
+		}
+
+		// Every native function seen from Lua is this closure, upvalue 1 is its ExternalPlan
+		int ExternalCallClosure(lua_State* L) {
+			return g_lualm.ExternalCall(L, lua_touserdata(L, lua_upvalueindex(1)));
+		}
+
+		// Class method dispatch, upvalue 1 is its BindingPlan
+		int ClassMethodClosure(lua_State* L) {
+			return g_lualm.CallClassMethod(L, lua_touserdata(L, lua_upvalueindex(1)));
+		}
+
+		bool IsOwnership(lua_State* L, int arg) {
+			const auto* context = GetContext(L);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, context->ownedRef);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, context->borrowedRef);
+			const bool result = lua_rawequal(L, arg, -2) || lua_rawequal(L, arg, -1);
+			lua_pop(L, 2);
+			return result;
+		}
+
+		// Pushes a new object of the class at cls holding the handle at handle
+		void PushClassHandle(lua_State* L, int handle, int cls, bool owned) {
+			handle = lua_absindex(L, handle);
+			cls = lua_absindex(L, cls);
+			lua_createtable(L, 0, 2);
+			lua_pushvalue(L, handle);
+			lua_setfield(L, -2, "_handle");
+			lua_rawgeti(L, LUA_REGISTRYINDEX, owned ? GetContext(L)->ownedRef : GetContext(L)->borrowedRef);
+			lua_setfield(L, -2, "_owned");
+			lua_pushvalue(L, cls);
+			lua_setmetatable(L, -2);
+		}
+
+		// Class constructor, upvalue 1 is its ClassPlan, 2 the invalid handle and 3 the class
+		int NewClassClosure(lua_State* L) {
+			return g_lualm.NewClassObject(L, lua_touserdata(L, lua_upvalueindex(1)));
+		}
+
+		// Lua value kinds as bits, integers and floats apart since integer
+		// parameters reject floats
+		enum ArgKind : uint16_t {
+			kArgNil = 1 << 0,
+			kArgBoolean = 1 << 1,
+			kArgInteger = 1 << 2,
+			kArgFloat = 1 << 3,
+			kArgString = 1 << 4,
+			kArgTable = 1 << 5,
+			kArgFunction = 1 << 6,
+			kArgUserdata = 1 << 7,
+			kArgLightUserdata = 1 << 8,
+			kArgThread = 1 << 9,
+			kArgAny = 0x3FF,
+		};
+
+		uint16_t GetArgKind(lua_State* L, int arg) {
+			switch (lua_type(L, arg)) {
+				case LUA_TNIL:           return kArgNil;
+				case LUA_TBOOLEAN:       return kArgBoolean;
+				case LUA_TNUMBER:        return lua_isinteger(L, arg) ? kArgInteger : kArgFloat;
+				case LUA_TSTRING:        return kArgString;
+				case LUA_TTABLE:         return kArgTable;
+				case LUA_TFUNCTION:      return kArgFunction;
+				case LUA_TUSERDATA:      return kArgUserdata;
+				case LUA_TLIGHTUSERDATA: return kArgLightUserdata;
+				default:                 return kArgThread;
+			}
+		}
+
+		// What ValueFromObject and ArrayFromObject take for a parameter type
+		uint16_t GetAcceptedKinds(ValueType type) {
+			switch (type) {
+				case ValueType::Bool:
+					return kArgBoolean;
+				case ValueType::Char8:
+				case ValueType::Char16:
+				case ValueType::String:
+					return kArgString | kArgInteger | kArgFloat;
+				case ValueType::Int8:
+				case ValueType::Int16:
+				case ValueType::Int32:
+				case ValueType::Int64:
+				case ValueType::UInt8:
+				case ValueType::UInt16:
+				case ValueType::UInt32:
+				case ValueType::UInt64:
+				case ValueType::Pointer:
+					return kArgInteger;
+				case ValueType::Float:
+				case ValueType::Double:
+					return kArgInteger | kArgFloat;
+				case ValueType::Function:
+					return kArgFunction | kArgNil;
+				case ValueType::Vector2:
+				case ValueType::Vector3:
+				case ValueType::Vector4:
+				case ValueType::Matrix4x4:
+					return kArgUserdata | kArgTable;
+				case ValueType::Any:
+					return kArgAny;
+				default:
+					// Arrays, as tables or buffers
+					return kArgTable | kArgUserdata;
+			}
+		}
+
+		// Appends the Lua type names of a kind mask, "integer|number" and the like
+		void PushKindNames(lua_State* L, uint16_t kinds) {
+			static constexpr std::pair<uint16_t, const char*> kNames[] = {
+				{kArgNil, "nil"}, {kArgBoolean, "boolean"}, {kArgInteger, "integer"}, {kArgFloat, "number"},
+				{kArgString, "string"}, {kArgTable, "table"}, {kArgFunction, "function"}, {kArgUserdata, "userdata"},
+				{kArgLightUserdata, "lightuserdata"}, {kArgThread, "thread"},
+			};
+			if (kinds == kArgAny) {
+				lua_pushliteral(L, "any");
+				return;
+			}
+			int count = 0;
+			for (const auto& [kind, name] : kNames) {
+				if (kinds & kind) {
+					lua_pushstring(L, count++ != 0 ? "|" : "");
+					lua_pushstring(L, name);
+					lua_concat(L, 2);
+				}
+			}
+			lua_concat(L, count);
+		}
+
+		// Object lifecycle, upvalue 1 is the destructor or nil and 2 the invalid handle
+		void ResetClassObject(lua_State* L) {
+			lua_pushvalue(L, lua_upvalueindex(2));
+			lua_setfield(L, 1, "_handle");
+			lua_rawgeti(L, LUA_REGISTRYINDEX, GetContext(L)->borrowedRef);
+			lua_setfield(L, 1, "_owned");
+		}
+
+		int CloseClassObject(lua_State* L) {
+			luaL_checktype(L, 1, LUA_TTABLE);
+			const int handle = lua_gettop(L) + 1;
+			lua_getfield(L, 1, "_handle");
+			if (!lua_toboolean(L, handle)) {
+				return 0;
+			}
+			if (!lua_rawequal(L, handle, lua_upvalueindex(2)) && !lua_isnil(L, lua_upvalueindex(1))) {
+				lua_getfield(L, 1, "_owned");
+				lua_rawgeti(L, LUA_REGISTRYINDEX, GetContext(L)->ownedRef);
+				if (lua_rawequal(L, -1, -2)) {
+					lua_pushvalue(L, lua_upvalueindex(1));
+					lua_pushvalue(L, handle);
+					lua_call(L, 1, 0);
+				}
+			}
+			ResetClassObject(L);
+			return 0;
+		}
+
+		int ReleaseClassObject(lua_State* L) {
+			luaL_checktype(L, 1, LUA_TTABLE);
+			lua_getfield(L, 1, "_handle");
+			if (!lua_toboolean(L, -1)) {
+				lua_pushvalue(L, lua_upvalueindex(2));
+				return 1;
+			}
+			ResetClassObject(L);
+			return 1; // The handle, no longer owned by the object
+		}
 
-			void ExternalCall(const Method* method, Address data, uint64_t* params, size_t count, void* ret) {
-				g_lualm.ExternalCall(*method, data, params, count, ret);
+		int GetClassHandle(lua_State* L) {
+			luaL_checktype(L, 1, LUA_TTABLE);
+			lua_getfield(L, 1, "_handle");
+			if (!lua_toboolean(L, -1)) {
+				lua_pushvalue(L, lua_upvalueindex(2));
 			}
+			return 1;
 		}
 
-		void LoadFile(const Method*, Address data, uint64_t* parameters, size_t count, void* return_) {
-			ParametersSpan params(parameters, count);
-			ReturnSlot ret(return_, ValueUtils::SizeOf(ValueType::Int32));
+		int IsClassObjectValid(lua_State* L) {
+			luaL_checktype(L, 1, LUA_TTABLE);
+			lua_getfield(L, 1, "_handle");
+			const bool valid = lua_toboolean(L, -1) && !lua_rawequal(L, -1, lua_upvalueindex(2));
+			lua_pushboolean(L, valid);
+			return 1;
+		}
+
+		const luaL_Reg kClassFuncs[] = {
+			{"close", CloseClassObject},
+			{"reset", CloseClassObject},
+			{"release", ReleaseClassObject},
+			{"get", GetClassHandle},
+			{"valid", IsClassObjectValid},
+			{"__close", CloseClassObject},
+			{"__gc", CloseClassObject},
+			{nullptr, nullptr}
+		};
+
+		// Suspends hard memory limits while the module allocates for a plugin
+		// outside lua_pcall: converting values, loading modules and registering
+		// exports. Enforce() turns them back on for the protected call itself.
+		class LimitScope {
+		public:
+			explicit LimitScope(LuaAllocator& allocator) : _allocator(allocator), _saved(allocator.SuspendLimits(true)) {}
+			~LimitScope() { _allocator.SuspendLimits(_saved); }
+			LimitScope(const LimitScope&) = delete;
+			LimitScope& operator=(const LimitScope&) = delete;
+
+			void Enforce(bool enforce) { _allocator.SuspendLimits(!enforce); }
+
+		private:
+			LuaAllocator& _allocator;
+			bool _saved;
+		};
 
-			// int (openf*)(lua_State* L)
-			const auto L = params.Get<lua_State*>(0);
-			const auto* filename = data.As<const char*>();
+		// Module loader for a script file, upvalue 1 is the file name
+		int LoadFile(lua_State* L) {
+			const char* filename = lua_tostring(L, lua_upvalueindex(1));
 
-			if (luaL_dofile(L, filename) != LUA_OK) {
+			// Loading and registering the module is charged but never refused,
+			// only the chunk itself runs protected
+			LimitScope limits(GetContext(L)->allocator);
+			int status = g_lualm.LoadScript(L, filename);
+			if (status == LUA_OK) {
+				limits.Enforce(true);
+				status = lua_pcall(L, 0, LUA_MULTRET, 0);
+				limits.Enforce(false);
+			}
+			if (status != LUA_OK) {
 				g_lualm.GetLogger()->Log(std::format(LOG_PREFIX "Failed to load module: {} - {}", filename, lua_tostring(L, -1)), Severity::Error);
 				lua_pop(L, 1);
-				ret.Set<int>(0);
-				return;
+				return 0;
+			}
+
+			return 1;
+		}
+
+		// Remembers which file backs a package.loaded entry, so a reload can drop it
+		void TrackModuleFile(lua_State* L, const char* modname, const char* filename) {
+			std::error_code ec;
+			fs::path path = fs::absolute(filename, ec);
+			GetContext(L)->moduleFiles.insert_or_assign(modname, ec ? fs::path(filename) : path.lexically_normal());
+		}
+
+		// luaL_requiref for a script file, leaves the module on the stack
+		void RequireFile(lua_State* L, const char* modname, const std::string& filename) {
+			// Runs outside lua_pcall, see LoadFile for the chunk itself
+			LimitScope limits(GetContext(L)->allocator);
+			TrackModuleFile(L, modname, filename.c_str());
+			luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+			lua_getfield(L, -1, modname); // Stack: loaded, loaded[modname]
+			if (!lua_toboolean(L, -1)) {
+				lua_pop(L, 1);
+				lua_pushlstring(L, filename.data(), filename.size());
+				lua_pushcclosure(L, &LoadFile, 1);
+				lua_pushstring(L, modname);
+				lua_call(L, 1, 1);
+				lua_pushvalue(L, -1);
+				lua_setfield(L, -3, modname); // loaded[modname] = module
+			}
+			lua_remove(L, -2); // Stack: module
+		}
+
+		// Replaces the Lua file searcher so required files also go through the
+		// bytecode cache. Upvalue 1 is the package table.
+		int SearchLuaFile(lua_State* L) {
+			const char* name = luaL_checkstring(L, 1);
+			lua_getfield(L, lua_upvalueindex(1), "searchpath");
+			lua_pushvalue(L, 1);
+			if (lua_getfield(L, lua_upvalueindex(1), "path") != LUA_TSTRING) {
+				return luaL_error(L, "'package.path' must be a string");
+			}
+			lua_call(L, 2, 2); // Stack: filename or nil, error message
+			if (lua_isnil(L, -2)) {
+				return 1; // Message of the failed lookup
+			}
+			lua_pop(L, 1);
+
+			const char* filename = lua_tostring(L, -1);
+			TrackModuleFile(L, name, filename);
+			if (g_lualm.LoadScript(L, filename) != LUA_OK) {
+				return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, filename, lua_tostring(L, -1));
+			}
+			lua_insert(L, -2); // Stack: chunk, filename
+			return 2;
+		}
+
+		// Every script below the extensions directory, in discovery order
+		std::vector<fs::path> FindScripts(const fs::path& root) {
+			std::vector<fs::path> scripts;
+			std::error_code ec;
+			for (fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+				if (it->is_regular_file(ec) && it->path().extension() == ".lua") {
+					scripts.push_back(it->path());
+				}
 			}
+			return scripts;
+		}
 
-			ret.Set<int>(1);
+		int ModuleIndex(lua_State* L) {
+			return g_lualm.IndexModule(L, lua_touserdata(L, lua_upvalueindex(1)));
 		}
 
 		int LoadEmpty(lua_State* L) {
@@ -206,12 +662,229 @@ namespace lualm {
 			return 1;
 		}
 
+		// Unprotected error, same as the luaL_newstate default but through the host logger
+		int Panic(lua_State* L) {
+			const char* msg = lua_type(L, -1) == LUA_TSTRING ? lua_tostring(L, -1) : "error object is not a string";
+			g_lualm.GetLogger()->Log(std::format(LOG_PREFIX "PANIC: unprotected error in call to Lua API ({})", msg), Severity::Fatal);
+			return 0;
+		}
+
+		// Applies to the calling plugin only
+		int SetBufferReturns(lua_State* L) {
+			luaL_checktype(L, 1, LUA_TBOOLEAN);
+			g_lualm.SetBufferReturns(L, lua_toboolean(L, 1));
+			return 0;
+		}
+
+		int SetStatsEnabled(lua_State* L) {
+			luaL_checktype(L, 1, LUA_TBOOLEAN);
+			g_lualm.SetStatsEnabled(lua_toboolean(L, 1));
+			return 0;
+		}
+
+		// Per function call counters, see LuaLanguageModule::PushStats
+		int Stats(lua_State* L) {
+			g_lualm.PushStats(L);
+			return 1;
+		}
+
+		// Count hook of every thread while the Lua profiler runs. Coroutines created
+		// before the start keep no hook, and ones created while running keep
+		// calling this after the stop, which is why sampler is checked.
+		void SampleHook(lua_State* L, lua_Debug*) {
+			auto* context = GetContext(L);
+			if (auto* sampler = context->sampler; sampler && sampler->Due()) {
+				const auto& allocator = context->allocator;
+				sampler->Sample(L, allocator.GetOwnerStats(allocator.GetOwner()).name);
+			}
+		}
+
+		void SampleAllocation(void* data, int kind, size_t size, size_t samples) {
+			g_lualm.RecordAllocation(*static_cast<LuaContext*>(data), kind, size, samples);
+		}
+
+		// One-shot hook armed by an allocation sample. The stack is consistent
+		// in a hook, unlike in the allocator, so the sample is located here.
+		void AllocationHook(lua_State* L, lua_Debug*) {
+			g_lualm.ResolveAllocations(L);
+		}
+
+		// Sets a flag for the lifetime of the scope, also when a Lua error unwinds it
+		class FlagScope {
+		public:
+			FlagScope(bool& flag, bool value) : _flag(flag), _saved(std::exchange(flag, value)) {}
+			~FlagScope() { _flag = _saved; }
+			FlagScope(const FlagScope&) = delete;
+			FlagScope& operator=(const FlagScope&) = delete;
+
+		private:
+			bool& _flag;
+			bool _saved;
+		};
+
+		// plugify.start_alloc_profiler([sample_rate_bytes])
+		int StartAllocProfiler(lua_State* L) {
+			const lua_Integer rate = luaL_optinteger(L, 1, 64 * 1024);
+			luaL_argcheck(L, rate > 0, 1, "sample rate must be positive");
+			lua_pushboolean(L, g_lualm.StartAllocationProfiler(static_cast<size_t>(rate)));
+			return 1;
+		}
+
+		// Returns the path of the written report, or nil
+		int StopAllocProfiler(lua_State* L) {
+			if (const auto path = g_lualm.StopAllocationProfiler()) {
+				const std::string& str = plg::as_string(*path);
+				lua_pushlstring(L, str.data(), str.size());
+			} else {
+				lua_pushnil(L);
+			}
+			return 1;
+		}
+
+		// plugify.start_timeline([capacity_events])
+		int StartTimeline(lua_State* L) {
+			const lua_Integer capacity = luaL_optinteger(L, 1, 64 * 1024);
+			luaL_argcheck(L, capacity > 0, 1, "capacity must be positive");
+			lua_pushboolean(L, g_lualm.StartTimeline(static_cast<size_t>(capacity)));
+			return 1;
+		}
+
+		// Writes the recorded events and keeps recording, returns the path or nil
+		int FlushTimeline(lua_State* L) {
+			if (const auto path = g_lualm.FlushTimeline()) {
+				const std::string& str = plg::as_string(*path);
+				lua_pushlstring(L, str.data(), str.size());
+			} else {
+				lua_pushnil(L);
+			}
+			return 1;
+		}
+
+		// Writes the recorded events and stops, returns the path or nil
+		int StopTimeline(lua_State* L) {
+			if (const auto path = g_lualm.StopTimeline()) {
+				const std::string& str = plg::as_string(*path);
+				lua_pushlstring(L, str.data(), str.size());
+			} else {
+				lua_pushnil(L);
+			}
+			return 1;
+		}
+
+		// plugify.start_profiler([interval_us[, instructions]])
+		int StartProfiler(lua_State* L) {
+			const lua_Integer interval = luaL_optinteger(L, 1, 1000);
+			const lua_Integer instructions = luaL_optinteger(L, 2, 1000);
+			luaL_argcheck(L, interval > 0, 1, "interval must be positive");
+			luaL_argcheck(L, instructions > 0 && instructions <= std::numeric_limits<int>::max(), 2, "instruction count out of range");
+			lua_pushboolean(L, g_lualm.StartSampling(std::chrono::microseconds(interval), static_cast<int>(instructions)));
+			return 1;
+		}
+
+		// Returns the path of the written folded stacks, or nil
+		int StopProfiler(lua_State* L) {
+			if (const auto path = g_lualm.StopSampling()) {
+				const std::string& str = plg::as_string(*path);
+				lua_pushlstring(L, str.data(), str.size());
+			} else {
+				lua_pushnil(L);
+			}
+			return 1;
+		}
+
+		// plugify.set_trace_mode("off" | "sampled" | "full"[, sample_rate])
+		int SetTraceMode(lua_State* L) {
+			static const char* const kModes[] = { "off", "sampled", "full", nullptr };
+			const int mode = luaL_checkoption(L, 1, nullptr, kModes);
+			const lua_Integer rate = luaL_optinteger(L, 2, 100);
+			luaL_argcheck(L, rate > 0 && rate <= std::numeric_limits<uint32_t>::max(), 2, "sample rate out of range");
+			g_lualm.SetTraceMode(static_cast<TraceMode>(mode), static_cast<uint32_t>(rate));
+			return 0;
+		}
+
+		// Drops one hand-out of a function passed to native code, the caller
+		// promises native code no longer holds it. Thunks are never reclaimed
+		// otherwise, native code may call them at any time.
+		int ReleaseCallback(lua_State* L) {
+			luaL_checktype(L, 1, LUA_TFUNCTION);
+			lua_pushboolean(L, g_lualm.ReleaseCallback(L, 1));
+			return 1;
+		}
+
+		// Queues a reload of a Lua plugin for the next module update, where no
+		// code of the plugin can be running
+		int RequestReload(lua_State* L) {
+			lua_pushboolean(L, g_lualm.RequestReload(luaL_checkstring(L, 1)));
+			return 1;
+		}
+
+		// Queues a full collection for the next module update, outside of any callback
+		int CollectGarbage(lua_State* L) {
+			GetContext(L)->gcRequested = true;
+			return 0;
+		}
+
+		// Counters of the calling state allocator
+		int MemoryStats(lua_State* L) {
+			const auto& allocator = GetContext(L)->allocator;
+			const auto& stats = allocator.GetStats();
+			lua_createtable(L, 0, 7);
+			lua_pushinteger(L, static_cast<lua_Integer>(stats.bytesInUse));
+			lua_setfield(L, -2, "bytes_in_use");
+			lua_pushinteger(L, static_cast<lua_Integer>(stats.peakBytes));
+			lua_setfield(L, -2, "peak_bytes");
+			lua_pushinteger(L, static_cast<lua_Integer>(stats.slabBytes));
+			lua_setfield(L, -2, "slab_bytes");
+			lua_pushinteger(L, static_cast<lua_Integer>(stats.largeBytes));
+			lua_setfield(L, -2, "large_bytes");
+			lua_pushinteger(L, static_cast<lua_Integer>(stats.allocations));
+			lua_setfield(L, -2, "allocations");
+			lua_pushinteger(L, static_cast<lua_Integer>(stats.frees));
+			lua_setfield(L, -2, "frees");
+			if (allocator.IsTracking()) {
+				// Usage charged to the plugin whose code is running
+				const auto& owner = allocator.GetOwnerStats(allocator.GetOwner());
+				lua_createtable(L, 0, 5);
+				lua_pushstring(L, owner.name.c_str());
+				lua_setfield(L, -2, "name");
+				lua_pushinteger(L, static_cast<lua_Integer>(owner.bytesInUse));
+				lua_setfield(L, -2, "bytes_in_use");
+				lua_pushinteger(L, static_cast<lua_Integer>(owner.peakBytes));
+				lua_setfield(L, -2, "peak_bytes");
+				lua_pushinteger(L, static_cast<lua_Integer>(owner.hardLimit));
+				lua_setfield(L, -2, "hard_limit");
+				lua_pushinteger(L, static_cast<lua_Integer>(owner.limitFailures));
+				lua_setfield(L, -2, "limit_failures");
+				lua_setfield(L, -2, "plugin");
+			}
+			return 1;
+		}
+
+		const luaL_Reg kPlugifyFuncs[] = {
+			{"set_buffer_returns", SetBufferReturns},
+			{"set_trace_mode", SetTraceMode},
+			{"set_stats", SetStatsEnabled},
+			{"stats", Stats},
+			{"start_profiler", StartProfiler},
+			{"stop_profiler", StopProfiler},
+			{"start_alloc_profiler", StartAllocProfiler},
+			{"stop_alloc_profiler", StopAllocProfiler},
+			{"start_timeline", StartTimeline},
+			{"flush_timeline", FlushTimeline},
+			{"stop_timeline", StopTimeline},
+			{"memory_stats", MemoryStats},
+			{"collect_garbage", CollectGarbage},
+			{"release_callback", ReleaseCallback},
+			{"reload_plugin", RequestReload},
+			{nullptr, nullptr}
+		};
+
 		int CustomRequire(lua_State* L) {
 			if (const char* modname = lua_tostring(L, 1)) {
-				g_lualm.ResolveRequiredModule(modname);
+				g_lualm.ResolveRequiredModule(L, modname);
 			}
 
-			lua_rawgeti(L, LUA_REGISTRYINDEX, g_lualm._originalRequireRef);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, GetContext(L)->originalRequireRef);
 			lua_insert(L, 1);
 			lua_call(L, lua_gettop(L) - 1, 1);
 			return 1;
@@ -416,7 +1089,22 @@ namespace lualm {
 				return { LuaAbstractType::Number, "number" };
 			}
 		}
-		if (type == LUA_TTABLE) {
+		if (type == LUA_TUSERDATA) {
+			switch (GetVectorType(arg)) {
+				case LuaAbstractType::Vector2:
+					return { LuaAbstractType::Vector2, "vector2" };
+				case LuaAbstractType::Vector3:
+					return { LuaAbstractType::Vector3, "vector3" };
+				case LuaAbstractType::Vector4:
+					return { LuaAbstractType::Vector4, "vector4" };
+				case LuaAbstractType::Matrix4x4:
+					return { LuaAbstractType::Matrix4x4, "matrix4x4" };
+				default:
+					break;
+			}
+		}
+		if (type == LUA_TTABLE || type == LUA_TUSERDATA) {
+			// Fallback for user types that only carry a __type name
 			const int absIndex = lua_absindex(_L, arg);
 			if (lua_getmetatable(_L, absIndex)) {
 				lua_getfield(_L, -1, "__type");
@@ -441,11 +1129,44 @@ namespace lualm {
 				}
 				lua_pop(_L, 2);
 			}
+			if (type == LUA_TUSERDATA) {
+				return { LuaAbstractType::Userdata, "userdata" };
+			}
 			return { LuaAbstractType::Table, "table" };
 		}
 		return { static_cast<LuaAbstractType>(type), lua_typename(_L, type) };
 	}
 
+	LuaAbstractType LuaLanguageModule::GetVectorType(int arg) const {
+		if (!lua_getmetatable(_L, arg)) {
+			return LuaAbstractType::Invalid;
+		}
+		const void* metatable = lua_topointer(_L, -1);
+		lua_pop(_L, 1);
+		if (metatable == _context->vector3Meta) {
+			return LuaAbstractType::Vector3;
+		}
+		if (metatable == _context->vector2Meta) {
+			return LuaAbstractType::Vector2;
+		}
+		if (metatable == _context->vector4Meta) {
+			return LuaAbstractType::Vector4;
+		}
+		if (metatable == _context->matrix4x4Meta) {
+			return LuaAbstractType::Matrix4x4;
+		}
+		return LuaAbstractType::Invalid;
+	}
+
+	const float* LuaLanguageModule::GetVectorData(int arg, const void* metatable) const {
+		if (lua_type(_L, arg) != LUA_TUSERDATA || !lua_getmetatable(_L, arg)) {
+			return nullptr;
+		}
+		const bool match = lua_topointer(_L, -1) == metatable;
+		lua_pop(_L, 1);
+		return match ? static_cast<const float*>(lua_touserdata(_L, arg)) : nullptr;
+	}
+
 	template<typename T>
 	std::optional<T> LuaLanguageModule::GetObjectAttrAsValue(int absIndex, const char* attrName) {
 		lua_getfield(_L, absIndex, attrName);
@@ -462,8 +1183,14 @@ namespace lualm {
 
 	template<>
 	std::optional<plg::vec2> LuaLanguageModule::ValueFromObject(int arg) {
+		if (const float* data = GetVectorData(arg, _context->vector2Meta)) {
+			plg::vec2 value;
+			LoadVector(data, value);
+			return value;
+		}
+
 		if (!lua_istable(_L, arg)) {
-			luaL_typeerror(_L, arg, lua_typename(_L, LUA_TTABLE));
+			luaL_typeerror(_L, arg, "vector2");
 			return std::nullopt;
 		}
 
@@ -498,8 +1225,14 @@ namespace lualm {
 
 	template<>
 	std::optional<plg::vec3> LuaLanguageModule::ValueFromObject(int arg) {
+		if (const float* data = GetVectorData(arg, _context->vector3Meta)) {
+			plg::vec3 value;
+			LoadVector(data, value);
+			return value;
+		}
+
 		if (!lua_istable(_L, arg)) {
-			luaL_typeerror(_L, arg, lua_typename(_L, LUA_TTABLE));
+			luaL_typeerror(_L, arg, "vector3");
 			return std::nullopt;
 		}
 
@@ -538,8 +1271,14 @@ namespace lualm {
 
 	template<>
 	std::optional<plg::vec4> LuaLanguageModule::ValueFromObject(int arg) {
+		if (const float* data = GetVectorData(arg, _context->vector4Meta)) {
+			plg::vec4 value;
+			LoadVector(data, value);
+			return value;
+		}
+
 		if (!lua_istable(_L, arg)) {
-			luaL_typeerror(_L, arg, lua_typename(_L, LUA_TTABLE));
+			luaL_typeerror(_L, arg, "vector4");
 			return std::nullopt;
 		}
 
@@ -582,8 +1321,14 @@ namespace lualm {
 
 	template<>
 	std::optional<plg::mat4x4> LuaLanguageModule::ValueFromObject(int arg) {
+		if (const float* data = GetVectorData(arg, _context->matrix4x4Meta)) {
+			plg::mat4x4 value;
+			LoadVector(data, value);
+			return value;
+		}
+
 		if (!lua_istable(_L, arg)) {
-			luaL_typeerror(_L, arg, lua_typename(_L, LUA_TTABLE));
+			luaL_typeerror(_L, arg, "matrix4x4");
 			return std::nullopt;
 		}
 
@@ -755,27 +1500,71 @@ namespace lualm {
 
 	template<typename T>
 	std::optional<plg::vector<T>> LuaLanguageModule::ArrayFromObject(int arg) {
+		if constexpr (is_buffer_element_v<T>) {
+			if (const auto* buffer = TestBuffer<T>(_L, arg)) {
+				return *buffer;
+			}
+		}
+
 		if (!lua_istable(_L, arg)) {
 			luaL_typeerror(_L, arg, lua_typename(_L, LUA_TTABLE));
 			return std::nullopt;
 		}
 
 		const size_t len = lua_rawlen(_L, arg);
+		const int absIndex = lua_absindex(_L, arg);
 
 		plg::vector<T> array;
-		array.reserve(len);
-
-		const int absIndex = lua_absindex(_L, arg);
 
-		for (lua_Integer i = 1; i <= static_cast<lua_Integer>(len); ++i) {
-			lua_rawgeti(_L, absIndex, i);
-			if (auto value = ValueFromObject<T>(-1)) {
-				array.emplace_back(std::move(*value));
-			} else {
+		if constexpr (is_lua_integer_v<T> || is_lua_number_v<T> || std::is_same_v<T, bool>) {
+			// Tight loop for numeric elements: read straight into the buffer and
+			// only fall back to ValueFromObject to raise the conversion error
+			array.resize(len);
+
+			for (size_t i = 0; i < len; ++i) {
+				lua_rawgeti(_L, absIndex, static_cast<lua_Integer>(i + 1));
+				if constexpr (is_lua_integer_v<T>) {
+					using V = std::conditional_t<std::is_signed_v<T>, lua_Integer, lua_Unsigned>;
+					if (lua_isinteger(_L, -1)) {
+						const auto value = static_cast<V>(lua_tointeger(_L, -1));
+						if (IsInRange<V, T>(value)) {
+							array[i] = static_cast<T>(value);
+							lua_pop(_L, 1);
+							continue;
+						}
+					}
+				} else if constexpr (is_lua_number_v<T>) {
+					int isnum{};
+					const lua_Number value = lua_tonumberx(_L, -1, &isnum);
+					if (isnum && IsInRange<lua_Number, T>(value)) {
+						array[i] = static_cast<T>(value);
+						lua_pop(_L, 1);
+						continue;
+					}
+				} else {
+					if (lua_isboolean(_L, -1)) {
+						array[i] = lua_toboolean(_L, -1);
+						lua_pop(_L, 1);
+						continue;
+					}
+				}
+				[[maybe_unused]] auto _ = ValueFromObject<T>(-1);
 				lua_pop(_L, 1);
 				return std::nullopt;
 			}
-			lua_pop(_L, 1);
+		} else {
+			array.reserve(len);
+
+			for (size_t i = 0; i < len; ++i) {
+				lua_rawgeti(_L, absIndex, static_cast<lua_Integer>(i + 1));
+				if (auto value = ValueFromObject<T>(-1)) {
+					array.emplace_back(std::move(*value));
+				} else {
+					lua_pop(_L, 1);
+					return std::nullopt;
+				}
+				lua_pop(_L, 1);
+			}
 		}
 
 		return array;
@@ -923,64 +1712,33 @@ namespace lualm {
 		return true;
 	}
 
+	template<typename T>
+	bool LuaLanguageModule::PushVectorObject(const T& value, int metatableRef) {
+		auto* data = static_cast<float*>(lua_newuserdatauv(_L, sizeof(float) * VectorTraits<T>::kSize, 0));
+		StoreVector(data, value);
+		lua_rawgeti(_L, LUA_REGISTRYINDEX, metatableRef);
+		lua_setmetatable(_L, -2);
+		return true;
+	}
+
 	template<>
 	bool LuaLanguageModule::PushLuaObject(const plg::vec2& value) {
-		lua_rawgeti(_L, LUA_REGISTRYINDEX, _vector2Ref);
-		lua_pushnumber(_L, value.x); // x
-		lua_pushnumber(_L, value.y); // y
-		if (lua_pcall(_L, 2, 1, 0) != LUA_OK) {
-			std::string errorString = std::format("Failed to create vector2: {}", lua_tostring(_L, -1));
-			lua_pop(_L, 1);
-			luaL_error(_L, errorString.c_str());
-			return false;
-		}
-		return true;
+		return PushVectorObject(value, _context->vector2Ref);
 	}
 
 	template<>
 	bool LuaLanguageModule::PushLuaObject(const plg::vec3& value) {
-		lua_rawgeti(_L, LUA_REGISTRYINDEX, _vector3Ref);
-		lua_pushnumber(_L, value.x); // x
-		lua_pushnumber(_L, value.y); // y
-		lua_pushnumber(_L, value.z); // z
-		if (lua_pcall(_L, 3, 1, 0) != LUA_OK) {
-			std::string errorString = std::format("Failed to create vector3: {}", lua_tostring(_L, -1));
-			lua_pop(_L, 1);
-			luaL_error(_L, errorString.c_str());
-			return false;
-		}
-		return true;
+		return PushVectorObject(value, _context->vector3Ref);
 	}
 
 	template<>
 	bool LuaLanguageModule::PushLuaObject(const plg::vec4& value) {
-		lua_rawgeti(_L, LUA_REGISTRYINDEX, _vector4Ref);
-		lua_pushnumber(_L, value.x); // x
-		lua_pushnumber(_L, value.y); // y
-		lua_pushnumber(_L, value.z); // z
-		lua_pushnumber(_L, value.w); // w
-		if (lua_pcall(_L, 4, 1, 0) != LUA_OK) {
-			std::string errorString = std::format("Failed to create vector4: {}", lua_tostring(_L, -1));
-			lua_pop(_L, 1);
-			luaL_error(_L, errorString.c_str());
-			return false;
-		}
-		return true;
+		return PushVectorObject(value, _context->vector4Ref);
 	}
 
 	template<>
 	bool LuaLanguageModule::PushLuaObject(const plg::mat4x4& value) {
-		lua_rawgeti(_L, LUA_REGISTRYINDEX, _matrix4x4Ref);
-		for (const auto& el : value.data) {
-			lua_pushnumber(_L, el);
-		}
-		if (lua_pcall(_L, 16, 1, 0) != LUA_OK) {
-			std::string errorString = std::format("Failed to create matrix4x4: {}", lua_tostring(_L, -1));
-			lua_pop(_L, 1);
-			luaL_error(_L, errorString.c_str());
-			return false;
-		}
-		return true;
+		return PushVectorObject(value, _context->matrix4x4Ref);
 	}
 
 	template<>
@@ -1013,73 +1771,169 @@ namespace lualm {
 			return std::nullopt;
 		}
 
-		lua_pushvalue(_L, arg);
-		int funcRef = luaL_ref(_L, LUA_REGISTRYINDEX);
-		auto funcObj = std::make_unique<LuaFunction>(LUA_NOREF, funcRef);
-
-		if (void* const funcAddr = FindInternal(*funcObj)) {
-			return funcAddr;
+		// Thunks are shared per function and prototype, the prototype decides
+		// the native signature and the argument plan
+		const int absArg = lua_absindex(_L, arg);
+		lua_rawgeti(_L, LUA_REGISTRYINDEX, _context->callbackCacheRef); // Stack: cache
+		lua_pushvalue(_L, absArg);
+		const bool created = lua_rawget(_L, -2) != LUA_TTABLE; // Stack: cache, entry
+		if (created) {
+			lua_pop(_L, 1);
+			lua_createtable(_L, 1, 1);
+			lua_pushvalue(_L, absArg);
+			lua_pushvalue(_L, -2);
+			lua_rawset(_L, -4); // cache[function] = entry
 		}
 
-		JitCallback callback{};
-		const Address methodAddr = callback.GetJitFunc(method, &detail::InternalCall, funcObj.get());
-		if (!methodAddr) {
-			luaL_error(_L, "Lang module JIT failed to generate C++ wrapper from callback object '%s'", callback.GetError().data());
-			return std::nullopt;
-		}
+		lua_rawgetp(_L, -1, &method); // Stack: cache, entry, thunk or nil
+		void* funcAddr = lua_touserdata(_L, -1);
+		lua_pop(_L, 1);
 
-		AddToFunctionsMap(methodAddr, *funcObj);
-		_internalFunctions.emplace_back(std::move(callback), std::move(funcObj));
+		if (!funcAddr) {
+			lua_pushvalue(_L, absArg);
+			int funcRef = luaL_ref(_L, LUA_REGISTRYINDEX);
+			const LuaFunction function{ LUA_NOREF, funcRef };
 
-		return methodAddr;
-	}
+			auto funcObj = std::make_unique<LuaCallback>(_context, _context->allocator.GetOwner(), function, CreateInternalPlan(method));
 
-	bool LuaLanguageModule::PushOrCreateFunctionObject(const Method& method, void* funcAddr) {
-		auto [_, methodRef] = FindExternal(funcAddr);
-		if (methodRef != LUA_NOREF) {
-			lua_rawgeti(_L, LUA_REGISTRYINDEX, methodRef);
-			return true;
-		}
+			JitCallback callback{};
+			const Address methodAddr = callback.GetJitFunc(method, &detail::InternalCall, funcObj.get());
+			if (!methodAddr) {
+				luaL_unref(_L, LUA_REGISTRYINDEX, funcRef);
+				if (created) {
+					lua_pushvalue(_L, absArg);
+					lua_pushnil(_L);
+					lua_rawset(_L, -4); // cache[function] = nil
+				}
+				lua_pop(_L, 2);
+				luaL_error(_L, "Lang module JIT failed to generate C++ wrapper from callback object '%s'", callback.GetError().data());
+				return std::nullopt;
+			}
+			funcAddr = methodAddr;
 
-		JitCall call{};
+			lua_pushlightuserdata(_L, funcAddr);
+			lua_rawsetp(_L, -2, &method); // entry[prototype] = thunk
 
-		const Address callAddr = call.GetJitFunc(method, funcAddr);
-		if (!callAddr) {
-			luaL_error(_L, "Lang module JIT failed to generate c++ call wrapper '%s'", call.GetError().data());
-			return false;
+			// Lets the original function come back when native code passes the thunk to Lua
+			_context->externalMap.emplace(funcAddr, function);
+			_internalFunctions.emplace(funcAddr, CallbackData{ std::move(callback), std::move(funcObj) });
 		}
 
-		JitCallback callback{};
+		// One count for all prototypes, release_callback does not know which one it drops
+		lua_rawgeti(_L, -1, 1);
+		lua_pushinteger(_L, lua_tointeger(_L, -1) + 1);
+		lua_rawseti(_L, -3, 1);
+		lua_pop(_L, 3); // Pop count, entry, cache
+
+		return funcAddr;
+	}
 
-		Signature sig{};
-		sig.AddArg(ValueType::Pointer);
-		sig.SetRet(ValueType::Int32);
+	bool LuaLanguageModule::ReleaseCallback(lua_State* L, int arg) {
+		ContextScope scope(*this, *GetContext(L), L);
 
-		const Address methodAddr = callback.GetJitFunc(sig, &method, &detail::ExternalCall, callAddr, false);
-		if (!methodAddr) {
-			luaL_error(_L, "Lang module JIT failed to generate c++ lua_CFunction wrapper '%s'", callback.GetError().data());
+		const int absArg = lua_absindex(_L, arg);
+		lua_rawgeti(_L, LUA_REGISTRYINDEX, _context->callbackCacheRef); // Stack: cache
+		lua_pushvalue(_L, absArg);
+		if (lua_rawget(_L, -2) != LUA_TTABLE) { // Stack: cache, entry
+			lua_pop(_L, 2);
 			return false;
 		}
 
-		lua_pushcfunction(_L, methodAddr.As<lua_CFunction>());
-		methodRef = luaL_ref(_L, LUA_REGISTRYINDEX);
-		lua_rawgeti(_L, LUA_REGISTRYINDEX, methodRef);
-
-		auto funcObj = std::make_unique<LuaFunction>(LUA_NOREF, methodRef);
+		lua_rawgeti(_L, -1, 1);
+		const lua_Integer uses = lua_tointeger(_L, -1) - 1;
+		lua_pop(_L, 1);
+		if (uses > 0) {
+			lua_pushinteger(_L, uses);
+			lua_rawseti(_L, -2, 1);
+			lua_pop(_L, 2);
+			return true;
+		}
 
-		AddToFunctionsMap(funcAddr, *funcObj);
-		_externalFunctions.emplace_back(std::move(callback), std::move(call), std::move(funcObj));
+		// Last hand-out, free the thunks of every prototype
+		lua_pushnil(_L);
+		while (lua_next(_L, -2)) { // Stack: cache, entry, key, value
+			if (lua_type(_L, -2) == LUA_TLIGHTUSERDATA) {
+				RetireCallback(lua_touserdata(_L, -1));
+			}
+			lua_pop(_L, 1);
+		}
+		lua_pop(_L, 1); // Pop entry
+
+		lua_pushvalue(_L, absArg);
+		lua_pushnil(_L);
+		lua_rawset(_L, -3); // cache[function] = nil
+		lua_pop(_L, 1);
+		return true;
+	}
+
+	void LuaLanguageModule::RetireCallback(void* funcAddr) {
+		const auto it = _internalFunctions.find(funcAddr);
+		if (it == _internalFunctions.end()) {
+			return;
+		}
+		LuaContext& context = *it->second.luaCallback->context;
+		context.externalMap.erase(funcAddr);
+		luaL_unref(context.L, LUA_REGISTRYINDEX, it->second.luaCallback->function.second);
+
+		// The thunk may be on the native stack right now, e.g. releasing from
+		// inside the callback, so its code is only freed on the next update
+		_retiredFunctions.emplace_back(std::move(it->second));
+		_internalFunctions.erase(it);
+	}
+
+	bool LuaLanguageModule::PushOrCreateFunctionObject(const Method& method, void* funcAddr) {
+		auto [_, methodRef] = FindExternal(funcAddr);
+		if (methodRef != LUA_NOREF) {
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, methodRef);
+			return true;
+		}
+
+		// The call wrapper is shared by all states, only the Lua closure is per state
+		auto it = _externalFunctions.find(funcAddr);
+		if (it == _externalFunctions.end()) {
+			JitCall call{};
+
+			const Address callAddr = call.GetJitFunc(method, funcAddr);
+			if (!callAddr) {
+				luaL_error(_L, "Lang module JIT failed to generate c++ call wrapper '%s'", call.GetError().data());
+				return false;
+			}
+
+			auto plan = CreateExternalPlan(method, callAddr.As<JitCall::CallingFunc>());
+			it = _externalFunctions.emplace(funcAddr, JitHolder{ std::move(call), std::move(plan) }).first;
+		}
+
+		PushExternalFunction(*it->second.plan);
+		methodRef = luaL_ref(_L, LUA_REGISTRYINDEX);
+		lua_rawgeti(_L, LUA_REGISTRYINDEX, methodRef);
+
+		AddToFunctionsMap(funcAddr, { LUA_NOREF, methodRef });
 
 		return true;
 	}
 
 	template<typename T>
 	bool LuaLanguageModule::PushLuaObjectList(const plg::vector<T>& value) {
-		lua_newtable(_L);
+		const size_t size = value.size();
+		lua_createtable(_L, static_cast<int>(std::min<size_t>(size, std::numeric_limits<int>::max())), 0);
 
-		for (size_t i = 0; i < value.size(); ++i) {
-			if (PushLuaObject(value[i])) {
-				lua_seti(_L, -2, static_cast<int>(i + 1));
+		if constexpr (is_lua_integer_v<T>) {
+			const T* const data = value.data();
+			for (size_t i = 0; i < size; ++i) {
+				lua_pushinteger(_L, static_cast<lua_Integer>(data[i]));
+				lua_rawseti(_L, -2, static_cast<lua_Integer>(i + 1));
+			}
+		} else if constexpr (is_lua_number_v<T>) {
+			const T* const data = value.data();
+			for (size_t i = 0; i < size; ++i) {
+				lua_pushnumber(_L, static_cast<lua_Number>(data[i]));
+				lua_rawseti(_L, -2, static_cast<lua_Integer>(i + 1));
+			}
+		} else {
+			for (size_t i = 0; i < size; ++i) {
+				if (PushLuaObject(value[i])) {
+					lua_rawseti(_L, -2, static_cast<lua_Integer>(i + 1));
+				}
 			}
 		}
 
@@ -1102,951 +1956,253 @@ namespace lualm {
 		return result;
 	}
 
+	template<typename T>
+	std::optional<T> LuaLanguageModule::ObjectToValue(int arg) {
+		if constexpr (is_plg_vector_v<T>) {
+			return ArrayFromObject<typename T::value_type>(arg);
+		} else {
+			return ValueFromObject<T>(arg);
+		}
+	}
+
+	template<typename T>
+	bool LuaLanguageModule::PushObject(const T& value) {
+		if constexpr (is_plg_vector_v<T>) {
+			return PushLuaObjectList(value);
+		} else {
+			return PushLuaObject(value);
+		}
+	}
+
 #pragma region InternalCall
 
-	void LuaLanguageModule::SetFallbackReturn(ValueType retType, ReturnSlot& ret) {
-		switch (retType) {
-			case ValueType::Void:
-				break;
-			case ValueType::Bool:
-				ret.Set<bool>({});
-				break;
-			case ValueType::Char8:
-				ret.Set<char>({});
-				break;
-			case ValueType::Char16:
-				ret.Set<char16_t>({});
-				break;
-			case ValueType::Int8:
-				ret.Set<int8_t>({});
-				break;
-			case ValueType::Int16:
-				ret.Set<int16_t>({});
-				break;
-			case ValueType::Int32:
-				ret.Set<int32_t>({});
-				break;
-			case ValueType::Int64:
-				ret.Set<int64_t>({});
-				break;
-			case ValueType::UInt8:
-				ret.Set<uint8_t>({});
-				break;
-			case ValueType::UInt16:
-				ret.Set<uint16_t>({});
-				break;
-			case ValueType::UInt32:
-				ret.Set<uint32_t>({});
-				break;
-			case ValueType::UInt64:
-				ret.Set<uint64_t>({});
-				break;
-			case ValueType::Pointer:
-				ret.Set<uintptr_t>({});
-				break;
-			case ValueType::Float:
-				ret.Set<float>({});
-				break;
-			case ValueType::Double:
-				ret.Set<double>({});
-				break;
-			case ValueType::Function:
-				ret.Set<void*>(nullptr);
-				break;
-			case ValueType::String:
-				ret.Construct<plg::string>();
-				break;
-			case ValueType::Any:
-				ret.Construct<plg::any>();
-				break;
-			case ValueType::ArrayBool:
-				ret.Construct<plg::vector<bool>>();
-				break;
-			case ValueType::ArrayChar8:
-				ret.Construct<plg::vector<char>>();
-				break;
-			case ValueType::ArrayChar16:
-				ret.Construct<plg::vector<char16_t>>();
-				break;
-			case ValueType::ArrayInt8:
-				ret.Construct<plg::vector<int8_t>>();
-				break;
-			case ValueType::ArrayInt16:
-				ret.Construct<plg::vector<int16_t>>();
-				break;
-			case ValueType::ArrayInt32:
-				ret.Construct<plg::vector<int32_t>>();
-				break;
-			case ValueType::ArrayInt64:
-				ret.Construct<plg::vector<int64_t>>();
-				break;
-			case ValueType::ArrayUInt8:
-				ret.Construct<plg::vector<uint8_t>>();
-				break;
-			case ValueType::ArrayUInt16:
-				ret.Construct<plg::vector<uint16_t>>();
-				break;
-			case ValueType::ArrayUInt32:
-				ret.Construct<plg::vector<uint32_t>>();
-				break;
-			case ValueType::ArrayUInt64:
-				ret.Construct<plg::vector<uint64_t>>();
-				break;
-			case ValueType::ArrayPointer:
-				ret.Construct<plg::vector<void*>>();
-				break;
-			case ValueType::ArrayFloat:
-				ret.Construct<plg::vector<float>>();
-				break;
-			case ValueType::ArrayDouble:
-				ret.Construct<plg::vector<double>>();
-				break;
-			case ValueType::ArrayString:
-				ret.Construct<plg::vector<plg::string>>();
-				break;
-			case ValueType::ArrayAny:
-				ret.Construct<plg::vector<plg::any>>();
-				break;
-			case ValueType::ArrayVector2:
-				ret.Construct<plg::vector<plg::vec2>>();
-				break;
-			case ValueType::ArrayVector3:
-				ret.Construct<plg::vector<plg::vec3>>();
-				break;
-			case ValueType::ArrayVector4:
-				ret.Construct<plg::vector<plg::vec4>>();
-				break;
-			case ValueType::ArrayMatrix4x4:
-				ret.Construct<plg::vector<plg::mat4x4>>();
-				break;
-			case ValueType::Vector2:
-				ret.Set<plg::vec2>({});
-				break;
-			case ValueType::Vector3:
-				ret.Set<plg::vec3>({});
-				break;
-			case ValueType::Vector4:
-				ret.Set<plg::vec4>({});
-				break;
-			case ValueType::Matrix4x4:
-				ret.Set<plg::mat4x4>({});
-				break;
-			default: {
-				_logger->Log(std::format(LOG_PREFIX "SetFallbackReturn unsupported type {:#x}", static_cast<uint8_t>(retType)), Severity::Fatal);
-				std::terminate();
-				break;
-			}
+	template<typename T>
+	bool LuaLanguageModule::ParamToObject(const Property&, ParametersSpan& params, size_t index) {
+		return PushObject(params.Get<T>(index));
+	}
+
+	template<typename T>
+	bool LuaLanguageModule::ParamRefToObject(const Property&, ParametersSpan& params, size_t index) {
+		return PushObject(*(params.Get<const T*>(index)));
+	}
+
+	bool LuaLanguageModule::ParamFunctionToObject(const Property& paramType, ParametersSpan& params, size_t index) {
+		return PushOrCreateFunctionObject(*paramType.GetPrototype(), params.Get<void*>(index));
+	}
+
+	bool LuaLanguageModule::ParamUnsupportedToObject(const Property& paramType, ParametersSpan&, size_t) {
+		_logger->Log(std::format(LOG_PREFIX "ParamToObject unsupported type {:#x}", static_cast<uint8_t>(paramType.GetType())), Severity::Fatal);
+		std::terminate();
+	}
+
+	template<typename T>
+	bool LuaLanguageModule::SetRefParam(int arg, ParametersSpan& params, size_t index) {
+		auto value = ObjectToValue<T>(arg);
+		if (!value) {
+			return false;
 		}
+		auto* const param = params.Get<T*>(index);
+		*param = std::move(*value);
+		return true;
 	}
 
-	bool LuaLanguageModule::SetReturn(int arg, const Property& retType, ReturnSlot& ret) {
-		switch (retType.GetType()) {
-			case ValueType::Void:
-				return true;
-			case ValueType::Bool:
-				if (auto value = ValueFromObject<bool>(arg)) {
-					ret.Set<bool>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Char8:
-				if (auto value = ValueFromObject<char>(arg)) {
-					ret.Set<char>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Char16:
-				if (auto value = ValueFromObject<char16_t>(arg)) {
-					ret.Set<char16_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Int8:
-				if (auto value = ValueFromObject<int8_t>(arg)) {
-					ret.Set<int8_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Int16:
-				if (auto value = ValueFromObject<int16_t>(arg)) {
-					ret.Set<int16_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Int32:
-				if (auto value = ValueFromObject<int32_t>(arg)) {
-					ret.Set<int32_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Int64:
-				if (auto value = ValueFromObject<int64_t>(arg)) {
-					ret.Set<int64_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::UInt8:
-				if (auto value = ValueFromObject<uint8_t>(arg)) {
-					ret.Set<uint8_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::UInt16:
-				if (auto value = ValueFromObject<uint16_t>(arg)) {
-					ret.Set<uint16_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::UInt32:
-				if (auto value = ValueFromObject<uint32_t>(arg)) {
-					ret.Set<uint32_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::UInt64:
-				if (auto value = ValueFromObject<uint64_t>(arg)) {
-					ret.Set<uint64_t>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Pointer:
-				if (auto value = ValueFromObject<void*>(arg)) {
-					ret.Set<void*>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Float:
-				if (auto value = ValueFromObject<float>(arg)) {
-					ret.Set<float>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Double:
-				if (auto value = ValueFromObject<double>(arg)) {
-					ret.Set<double>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Function:
-				if (auto value = GetOrCreateFunctionValue(*retType.GetPrototype(), arg)) {
-					ret.Set<void*>(*value);
-					return true;
-				}
-				break;
-			case ValueType::String:
-				if (auto value = ValueFromObject<plg::string>(arg)) {
-					ret.Construct<plg::string>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::Any:
-				if (auto value = ValueFromObject<plg::any>(arg)) {
-					ret.Construct<plg::any>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayBool:
-				if (auto value = ArrayFromObject<bool>(arg)) {
-					ret.Construct<plg::vector<bool>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayChar8:
-				if (auto value = ArrayFromObject<char>(arg)) {
-					ret.Construct<plg::vector<char>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayChar16:
-				if (auto value = ArrayFromObject<char16_t>(arg)) {
-					ret.Construct<plg::vector<char16_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayInt8:
-				if (auto value = ArrayFromObject<int8_t>(arg)) {
-					ret.Construct<plg::vector<int8_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayInt16:
-				if (auto value = ArrayFromObject<int16_t>(arg)) {
-					ret.Construct<plg::vector<int16_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayInt32:
-				if (auto value = ArrayFromObject<int32_t>(arg)) {
-					ret.Construct<plg::vector<int32_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayInt64:
-				if (auto value = ArrayFromObject<int64_t>(arg)) {
-					ret.Construct<plg::vector<int64_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayUInt8:
-				if (auto value = ArrayFromObject<uint8_t>(arg)) {
-					ret.Construct<plg::vector<uint8_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayUInt16:
-				if (auto value = ArrayFromObject<uint16_t>(arg)) {
-					ret.Construct<plg::vector<uint16_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayUInt32:
-				if (auto value = ArrayFromObject<uint32_t>(arg)) {
-					ret.Construct<plg::vector<uint32_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayUInt64:
-				if (auto value = ArrayFromObject<uint64_t>(arg)) {
-					ret.Construct<plg::vector<uint64_t>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayPointer:
-				if (auto value = ArrayFromObject<void*>(arg)) {
-					ret.Construct<plg::vector<void*>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayFloat:
-				if (auto value = ArrayFromObject<float>(arg)) {
-					ret.Construct<plg::vector<float>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayDouble:
-				if (auto value = ArrayFromObject<double>(arg)) {
-					ret.Construct<plg::vector<double>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayString:
-				if (auto value = ArrayFromObject<plg::string>(arg)) {
-					ret.Construct<plg::vector<plg::string>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayAny:
-				if (auto value = ArrayFromObject<plg::any>(arg)) {
-					ret.Construct<plg::vector<plg::any>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayVector2:
-				if (auto value = ArrayFromObject<plg::vec2>(arg)) {
-					ret.Construct<plg::vector<plg::vec2>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayVector3:
-				if (auto value = ArrayFromObject<plg::vec3>(arg)) {
-					ret.Construct<plg::vector<plg::vec3>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayVector4:
-				if (auto value = ArrayFromObject<plg::vec4>(arg)) {
-					ret.Construct<plg::vector<plg::vec4>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::ArrayMatrix4x4:
-				if (auto value = ArrayFromObject<plg::mat4x4>(arg)) {
-					ret.Construct<plg::vector<plg::mat4x4>>(std::move(*value));
-					return true;
-				}
-				break;
-			case ValueType::Vector2:
-				if (auto value = ValueFromObject<plg::vec2>(arg)) {
-					ret.Set<plg::vec2>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Vector3:
-				if (auto value = ValueFromObject<plg::vec3>(arg)) {
-					ret.Set<plg::vec3>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Vector4:
-				if (auto value = ValueFromObject<plg::vec4>(arg)) {
-					ret.Set<plg::vec4>(*value);
-					return true;
-				}
-				break;
-			case ValueType::Matrix4x4:
-				if (auto value = ValueFromObject<plg::mat4x4>(arg)) {
-					ret.Set<plg::mat4x4>(*value);
-					return true;
-				}
-				break;
-			default: {
-				_logger->Log(std::format(LOG_PREFIX "SetReturn unsupported type {:#x}", static_cast<uint8_t>(retType.GetType())), Severity::Fatal);
-				std::terminate();
-				break;
-			}
+	template<typename T>
+	bool LuaLanguageModule::SetReturn(int arg, const Property&, ReturnSlot& ret) {
+		auto value = ObjectToValue<T>(arg);
+		if (!value) {
+			return false;
+		}
+		if constexpr (std::is_trivially_copyable_v<T>) {
+			ret.Set<T>(*value);
+		} else {
+			ret.Construct<T>(std::move(*value));
 		}
+		return true;
+	}
 
-		return false;
+	bool LuaLanguageModule::SetVoidReturn(int, const Property&, ReturnSlot&) {
+		return true;
 	}
 
-	bool LuaLanguageModule::SetRefParam(int arg, const Property& paramType, ParametersSpan& params, size_t index) {
-		switch (paramType.GetType()) {
-			case ValueType::Bool:
-				if (auto value = ValueFromObject<bool>(arg)) {
-					auto* const param = params.Get<bool*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Char8:
-				if (auto value = ValueFromObject<char>(arg)) {
-					auto* const param = params.Get<char*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Char16:
-				if (auto value = ValueFromObject<char16_t>(arg)) {
-					auto* const param = params.Get<char16_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Int8:
-				if (auto value = ValueFromObject<int8_t>(arg)) {
-					auto* const param = params.Get<int8_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Int16:
-				if (auto value = ValueFromObject<int16_t>(arg)) {
-					auto* const param = params.Get<int16_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Int32:
-				if (auto value = ValueFromObject<int32_t>(arg)) {
-					auto* const param = params.Get<int32_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Int64:
-				if (auto value = ValueFromObject<int64_t>(arg)) {
-					auto* const param = params.Get<int64_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::UInt8:
-				if (auto value = ValueFromObject<uint8_t>(arg)) {
-					auto* const param = params.Get<uint8_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::UInt16:
-				if (auto value = ValueFromObject<uint16_t>(arg)) {
-					auto* const param = params.Get<uint16_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::UInt32:
-				if (auto value = ValueFromObject<uint32_t>(arg)) {
-					auto* const param = params.Get<uint32_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::UInt64:
-				if (auto value = ValueFromObject<uint64_t>(arg)) {
-					auto* const param = params.Get<uint64_t*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Pointer:
-				if (auto value = ValueFromObject<void*>(arg)) {
-					auto* const param = params.Get<void**>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Float:
-				if (auto value = ValueFromObject<float>(arg)) {
-					auto* const param = params.Get<float*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Double:
-				if (auto value = ValueFromObject<double>(arg)) {
-					auto* const param = params.Get<double*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::String:
-				if (auto value = ValueFromObject<plg::string>(arg)) {
-					auto* const param = params.Get<plg::string*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::Any:
-				if (auto value = ValueFromObject<plg::any>(arg)) {
-					auto* const param = params.Get<plg::any*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayBool:
-				if (auto value = ArrayFromObject<bool>(arg)) {
-					auto* const param = params.Get<plg::vector<bool>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayChar8:
-				if (auto value = ArrayFromObject<char>(arg)) {
-					auto* const param = params.Get<plg::vector<char>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayChar16:
-				if (auto value = ArrayFromObject<char16_t>(arg)) {
-					auto* const param = params.Get<plg::vector<char16_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayInt8:
-				if (auto value = ArrayFromObject<int8_t>(arg)) {
-					auto* const param = params.Get<plg::vector<int8_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayInt16:
-				if (auto value = ArrayFromObject<int16_t>(arg)) {
-					auto* const param = params.Get<plg::vector<int16_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayInt32:
-				if (auto value = ArrayFromObject<int32_t>(arg)) {
-					auto* const param = params.Get<plg::vector<int32_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayInt64:
-				if (auto value = ArrayFromObject<int64_t>(arg)) {
-					auto* const param = params.Get<plg::vector<int64_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayUInt8:
-				if (auto value = ArrayFromObject<uint8_t>(arg)) {
-					auto* const param = params.Get<plg::vector<uint8_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayUInt16:
-				if (auto value = ArrayFromObject<uint16_t>(arg)) {
-					auto* const param = params.Get<plg::vector<uint16_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayUInt32:
-				if (auto value = ArrayFromObject<uint32_t>(arg)) {
-					auto* const param = params.Get<plg::vector<uint32_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayUInt64:
-				if (auto value = ArrayFromObject<uint64_t>(arg)) {
-					auto* const param = params.Get<plg::vector<uint64_t>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayPointer:
-				if (auto value = ArrayFromObject<void*>(arg)) {
-					auto* const param = params.Get<plg::vector<void*>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayFloat:
-				if (auto value = ArrayFromObject<float>(arg)) {
-					auto* const param = params.Get<plg::vector<float>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayDouble:
-				if (auto value = ArrayFromObject<double>(arg)) {
-					auto* const param = params.Get<plg::vector<double>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayString:
-				if (auto value = ArrayFromObject<plg::string>(arg)) {
-					auto* const param = params.Get<plg::vector<plg::string>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayAny:
-				if (auto value = ArrayFromObject<plg::any>(arg)) {
-					auto* const param = params.Get<plg::vector<plg::any>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayVector2:
-				if (auto value = ArrayFromObject<plg::vec2>(arg)) {
-					auto* const param = params.Get<plg::vector<plg::vec2>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayVector3:
-				if (auto value = ArrayFromObject<plg::vec3>(arg)) {
-					auto* const param = params.Get<plg::vector<plg::vec3>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayVector4:
-				if (auto value = ArrayFromObject<plg::vec4>(arg)) {
-					auto* const param = params.Get<plg::vector<plg::vec4>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::ArrayMatrix4x4:
-				if (auto value = ArrayFromObject<plg::mat4x4>(arg)) {
-					auto* const param = params.Get<plg::vector<plg::mat4x4>*>(index);
-					*param = std::move(*value);
-					return true;
-				}
-				break;
-			case ValueType::Vector2:
-				if (auto value = ValueFromObject<plg::vec2>(arg)) {
-					auto* const param = params.Get<plg::vec2*>(index);
-					*param = *value;
-					return true;
-				}
-				break;
-			case ValueType::Vector3:
-				if (auto value = ValueFromObject<plg::vec3>(arg)) {
-					auto* const param = params.Get<plg::vec3*>(index);
-					*param = *value;
-					return true;
+	bool LuaLanguageModule::SetFunctionReturn(int arg, const Property& retType, ReturnSlot& ret) {
+		auto value = GetOrCreateFunctionValue(*retType.GetPrototype(), arg);
+		if (!value) {
+			return false;
+		}
+		ret.Set<void*>(*value);
+		return true;
+	}
+
+	template<typename T>
+	void LuaLanguageModule::SetFallbackReturn(ReturnSlot& ret) {
+		if constexpr (std::is_trivially_copyable_v<T>) {
+			ret.Set<T>({});
+		} else {
+			ret.Construct<T>();
+		}
+	}
+
+	void LuaLanguageModule::SetVoidFallbackReturn(ReturnSlot&) {
+	}
+
+	LuaLanguageModule::InternalPlan LuaLanguageModule::CreateInternalPlan(const Method& method) const {
+		const auto& retType = method.GetRetType();
+		const auto& paramTypes = method.GetParamTypes();
+
+		InternalPlan plan;
+		plan.method = &method;
+		plan.retType = &retType;
+		plan.retSize = ValueUtils::SizeOf(retType.GetType());
+		plan.params.reserve(paramTypes.size());
+
+		for (size_t index = 0; index < paramTypes.size(); ++index) {
+			const Property& paramType = paramTypes[index];
+			const bool isRef = paramType.IsRef();
+
+			ParamToObjectFunc push{};
+			if (paramType.GetType() == ValueType::Function) {
+				push = isRef ? nullptr : &LuaLanguageModule::ParamFunctionToObject;
+			} else {
+				push = VisitValueType(paramType.GetType(), [isRef]<typename T>() -> ParamToObjectFunc {
+					if constexpr (IsPassedByValue<T>()) {
+						if (!isRef) {
+							return &LuaLanguageModule::ParamToObject<T>;
+						}
+					}
+					return &LuaLanguageModule::ParamRefToObject<T>;
+				});
+			}
+			plan.params.emplace_back(push ? push : &LuaLanguageModule::ParamUnsupportedToObject, &paramType);
+
+			if (isRef) {
+				const auto set = VisitValueType(paramType.GetType(), []<typename T>() -> SetRefParamFunc {
+					return &LuaLanguageModule::SetRefParam<T>;
+				});
+				if (!set) {
+					_logger->Log(std::format(LOG_PREFIX "SetRefParam unsupported type {:#x}", static_cast<uint8_t>(paramType.GetType())), Severity::Fatal);
+					std::terminate();
 				}
+				plan.refParams.emplace_back(set, index);
+			}
+		}
+
+		switch (retType.GetType()) {
+			case ValueType::Void:
+				plan.ret = &LuaLanguageModule::SetVoidReturn;
+				plan.fallback = &LuaLanguageModule::SetVoidFallbackReturn;
 				break;
-			case ValueType::Vector4:
-				if (auto value = ValueFromObject<plg::vec4>(arg)) {
-					auto* const param = params.Get<plg::vec4*>(index);
-					*param = *value;
-					return true;
-				}
+			case ValueType::Function:
+				plan.ret = &LuaLanguageModule::SetFunctionReturn;
+				plan.fallback = &LuaLanguageModule::SetFallbackReturn<void*>;
 				break;
-			case ValueType::Matrix4x4:
-				if (auto value = ValueFromObject<plg::mat4x4>(arg)) {
-					auto* const param = params.Get<plg::mat4x4*>(index);
-					*param = *value;
-					return true;
+			default:
+				plan.ret = VisitValueType(retType.GetType(), []<typename T>() -> SetReturnFunc {
+					return &LuaLanguageModule::SetReturn<T>;
+				});
+				plan.fallback = VisitValueType(retType.GetType(), []<typename T>() -> SetFallbackReturnFunc {
+					return &LuaLanguageModule::SetFallbackReturn<T>;
+				});
+				if (!plan.ret) {
+					_logger->Log(std::format(LOG_PREFIX "SetReturn unsupported type {:#x}", static_cast<uint8_t>(retType.GetType())), Severity::Fatal);
+					std::terminate();
 				}
 				break;
-			default: {
-				_logger->Log(std::format(LOG_PREFIX "SetRefParam unsupported type {:#x}", static_cast<uint8_t>(paramType.GetType())), Severity::Fatal);
-				std::terminate();
-				break;
-			}
 		}
 
-		return false;
-	}
+		const int refParamsCount = static_cast<int>(plan.refParams.size());
+		const bool hasRet = retType.GetType() != ValueType::Void || refParamsCount != 0;
+		plan.returnCount = hasRet + refParamsCount;
 
-	bool LuaLanguageModule::ParamToObject(const Property& paramType, ParametersSpan& params, size_t index) {
-		switch (paramType.GetType()) {
-			case ValueType::Bool:
-				return PushLuaObject(params.Get<bool>(index));
-			case ValueType::Char8:
-				return PushLuaObject(params.Get<char>(index));
-			case ValueType::Char16:
-				return PushLuaObject(params.Get<char16_t>(index));
-			case ValueType::Int8:
-				return PushLuaObject(params.Get<int8_t>(index));
-			case ValueType::Int16:
-				return PushLuaObject(params.Get<int16_t>(index));
-			case ValueType::Int32:
-				return PushLuaObject(params.Get<int32_t>(index));
-			case ValueType::Int64:
-				return PushLuaObject(params.Get<int64_t>(index));
-			case ValueType::UInt8:
-				return PushLuaObject(params.Get<uint8_t>(index));
-			case ValueType::UInt16:
-				return PushLuaObject(params.Get<uint16_t>(index));
-			case ValueType::UInt32:
-				return PushLuaObject(params.Get<uint32_t>(index));
-			case ValueType::UInt64:
-				return PushLuaObject(params.Get<uint64_t>(index));
-			case ValueType::Pointer:
-				return PushLuaObject(params.Get<void*>(index));
-			case ValueType::Float:
-				return PushLuaObject(params.Get<float>(index));
-			case ValueType::Double:
-				return PushLuaObject(params.Get<double>(index));
-			case ValueType::Function:
-				return PushOrCreateFunctionObject(*paramType.GetPrototype(), params.Get<void*>(index));
-			case ValueType::String:
-				return PushLuaObject(*(params.Get<const plg::string*>(index)));
-			case ValueType::Any:
-				return PushLuaObject(*(params.Get<const plg::any*>(index)));
-			case ValueType::ArrayBool:
-				return PushLuaObjectList(*(params.Get<const plg::vector<bool>*>(index)));
-			case ValueType::ArrayChar8:
-				return PushLuaObjectList(*(params.Get<const plg::vector<char>*>(index)));
-			case ValueType::ArrayChar16:
-				return PushLuaObjectList(*(params.Get<const plg::vector<char16_t>*>(index)));
-			case ValueType::ArrayInt8:
-				return PushLuaObjectList(*(params.Get<const plg::vector<int8_t>*>(index)));
-			case ValueType::ArrayInt16:
-				return PushLuaObjectList(*(params.Get<const plg::vector<int16_t>*>(index)));
-			case ValueType::ArrayInt32:
-				return PushLuaObjectList(*(params.Get<const plg::vector<int32_t>*>(index)));
-			case ValueType::ArrayInt64:
-				return PushLuaObjectList(*(params.Get<const plg::vector<int64_t>*>(index)));
-			case ValueType::ArrayUInt8:
-				return PushLuaObjectList(*(params.Get<const plg::vector<uint8_t>*>(index)));
-			case ValueType::ArrayUInt16:
-				return PushLuaObjectList(*(params.Get<const plg::vector<uint16_t>*>(index)));
-			case ValueType::ArrayUInt32:
-				return PushLuaObjectList(*(params.Get<const plg::vector<uint32_t>*>(index)));
-			case ValueType::ArrayUInt64:
-				return PushLuaObjectList(*(params.Get<const plg::vector<uint64_t>*>(index)));
-			case ValueType::ArrayPointer:
-				return PushLuaObjectList(*(params.Get<const plg::vector<void*>*>(index)));
-			case ValueType::ArrayFloat:
-				return PushLuaObjectList(*(params.Get<const plg::vector<float>*>(index)));
-			case ValueType::ArrayDouble:
-				return PushLuaObjectList(*(params.Get<const plg::vector<double>*>(index)));
-			case ValueType::ArrayString:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::string>*>(index)));
-			case ValueType::ArrayAny:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::any>*>(index)));
-			case ValueType::ArrayVector2:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::vec2>*>(index)));
-			case ValueType::ArrayVector3:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::vec3>*>(index)));
-			case ValueType::ArrayVector4:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::vec4>*>(index)));
-			case ValueType::ArrayMatrix4x4:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::mat4x4>*>(index)));
-			case ValueType::Vector2:
-				return PushLuaObject(*(params.Get<plg::vec2*>(index)));
-			case ValueType::Vector3:
-				return PushLuaObject(*(params.Get<plg::vec3*>(index)));
-			case ValueType::Vector4:
-				return PushLuaObject(*(params.Get<plg::vec4*>(index)));
-			case ValueType::Matrix4x4:
-				return PushLuaObject(*(params.Get<plg::mat4x4*>(index)));
-			default: {
-				_logger->Log(std::format(LOG_PREFIX "ParamToObject unsupported type {:#x}", static_cast<uint8_t>(paramType.GetType())), Severity::Fatal);
-				std::terminate();
-			}
-		}
+		return plan;
 	}
 
-	bool LuaLanguageModule::ParamRefToObject(const Property& paramType, ParametersSpan& params, size_t index) {
-		switch (paramType.GetType()) {
-			case ValueType::Bool:
-				return PushLuaObject(*(params.Get<bool*>(index)));
-			case ValueType::Char8:
-				return PushLuaObject(*(params.Get<char*>(index)));
-			case ValueType::Char16:
-				return PushLuaObject(*(params.Get<char16_t*>(index)));
-			case ValueType::Int8:
-				return PushLuaObject(*(params.Get<int8_t*>(index)));
-			case ValueType::Int16:
-				return PushLuaObject(*(params.Get<int16_t*>(index)));
-			case ValueType::Int32:
-				return PushLuaObject(*(params.Get<int32_t*>(index)));
-			case ValueType::Int64:
-				return PushLuaObject(*(params.Get<int64_t*>(index)));
-			case ValueType::UInt8:
-				return PushLuaObject(*(params.Get<uint8_t*>(index)));
-			case ValueType::UInt16:
-				return PushLuaObject(*(params.Get<uint16_t*>(index)));
-			case ValueType::UInt32:
-				return PushLuaObject(*(params.Get<uint32_t*>(index)));
-			case ValueType::UInt64:
-				return PushLuaObject(*(params.Get<uint64_t*>(index)));
-			case ValueType::Pointer:
-				return PushLuaObject(*(params.Get<void**>(index)));
-			case ValueType::Float:
-				return PushLuaObject(*(params.Get<float*>(index)));
-			case ValueType::Double:
-				return PushLuaObject(*(params.Get<double*>(index)));
-			case ValueType::String:
-				return PushLuaObject(*(params.Get<const plg::string*>(index)));
-			case ValueType::Any:
-				return PushLuaObject(*(params.Get<const plg::any*>(index)));
-			case ValueType::ArrayBool:
-				return PushLuaObjectList(*(params.Get<const plg::vector<bool>*>(index)));
-			case ValueType::ArrayChar8:
-				return PushLuaObjectList(*(params.Get<const plg::vector<char>*>(index)));
-			case ValueType::ArrayChar16:
-				return PushLuaObjectList(*(params.Get<const plg::vector<char16_t>*>(index)));
-			case ValueType::ArrayInt8:
-				return PushLuaObjectList(*(params.Get<const plg::vector<int8_t>*>(index)));
-			case ValueType::ArrayInt16:
-				return PushLuaObjectList(*(params.Get<const plg::vector<int16_t>*>(index)));
-			case ValueType::ArrayInt32:
-				return PushLuaObjectList(*(params.Get<const plg::vector<int32_t>*>(index)));
-			case ValueType::ArrayInt64:
-				return PushLuaObjectList(*(params.Get<const plg::vector<int64_t>*>(index)));
-			case ValueType::ArrayUInt8:
-				return PushLuaObjectList(*(params.Get<const plg::vector<uint8_t>*>(index)));
-			case ValueType::ArrayUInt16:
-				return PushLuaObjectList(*(params.Get<const plg::vector<uint16_t>*>(index)));
-			case ValueType::ArrayUInt32:
-				return PushLuaObjectList(*(params.Get<const plg::vector<uint32_t>*>(index)));
-			case ValueType::ArrayUInt64:
-				return PushLuaObjectList(*(params.Get<const plg::vector<uint64_t>*>(index)));
-			case ValueType::ArrayPointer:
-				return PushLuaObjectList(*(params.Get<const plg::vector<void*>*>(index)));
-			case ValueType::ArrayFloat:
-				return PushLuaObjectList(*(params.Get<const plg::vector<float>*>(index)));
-			case ValueType::ArrayDouble:
-				return PushLuaObjectList(*(params.Get<const plg::vector<double>*>(index)));
-			case ValueType::ArrayString:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::string>*>(index)));
-			case ValueType::ArrayAny:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::any>*>(index)));
-			case ValueType::ArrayVector2:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::vec2>*>(index)));
-			case ValueType::ArrayVector3:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::vec3>*>(index)));
-			case ValueType::ArrayVector4:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::vec4>*>(index)));
-			case ValueType::ArrayMatrix4x4:
-				return PushLuaObjectList(*(params.Get<const plg::vector<plg::mat4x4>*>(index)));
-			case ValueType::Vector2:
-				return PushLuaObject(*(params.Get<plg::vec2*>(index)));
-			case ValueType::Vector3:
-				return PushLuaObject(*(params.Get<plg::vec3*>(index)));
-			case ValueType::Vector4:
-				return PushLuaObject(*(params.Get<plg::vec4*>(index)));
-			case ValueType::Matrix4x4:
-				return PushLuaObject(*(params.Get<plg::mat4x4*>(index)));
-			default: {
-				_logger->Log(std::format(LOG_PREFIX "ParamRefToObject unsupported type {:#x}", static_cast<uint8_t>(paramType.GetType())), Severity::Fatal);
-				std::terminate();
+	void LuaLanguageModule::InternalCall(const Method&, Address data, uint64_t* parameters, size_t count, void* return_) {
+		auto& [context, owner, function, plan, staleReported] = *data.As<LuaCallback*>();
+		const auto& [pluginRef, methodRef] = function;
+
+		if (methodRef == LUA_NOREF) {
+			// Handed to native code by an instance that was reloaded since
+			if (!std::exchange(staleReported, true)) {
+				_logger->Log(std::format(LOG_PREFIX "'{}' was called after its plugin was reloaded, returning a default value", plan.method->GetName()), Severity::Warning);
 			}
+			ReturnSlot ret(return_, plan.retSize);
+			(this->*plan.fallback)(ret);
+			return;
 		}
-	}
-
-	void LuaLanguageModule::InternalCall(const Method& method, Address data, uint64_t* parameters, size_t count, void* return_) {
-		const auto& [pluginRef, methodRef] = *data.As<LuaFunction*>();
 
-		const auto& retType = method.GetRetType();
-		const auto& paramTypes = method.GetParamTypes();
-		const size_t paramsCount = paramTypes.size();
+		// Stay on the running thread when called back from the same state
+		ContextScope scope(*this, *context, context == _context ? _L : context->L, owner);
+		const CollectorHold hold(*context, IsPacedGc());
+		const TimelineRecorder::Span span(_timeline.get(), TimelineRecorder::Category::Export, plan.method->GetName());
 
 		ParametersSpan params(parameters, count);
-		ReturnSlot ret(return_, ValueUtils::SizeOf(retType.GetType()));
+		ReturnSlot ret(return_, plan.retSize);
 
-		int refParamsCount = 0;
+		const bool timed = _statsEnabled;
+		const auto start = timed ? CallStats::Clock::now() : CallStats::Clock::time_point{};
+		FlagScope marshalling(_marshalling, true);
+		// A plugin at its hard limit fails inside the call instead, which is logged
+		LimitScope limits(context->allocator);
+
+		const int top = lua_gettop(_L);
+		const size_t paramsCount = plan.params.size();
 		int argCount = static_cast<int>(paramsCount);
 
-		if (pluginRef != LUA_NOREF) {
-			lua_rawgeti(_L, LUA_REGISTRYINDEX, pluginRef);
-		}
 		lua_rawgeti(_L, LUA_REGISTRYINDEX, methodRef);
 		if (pluginRef != LUA_NOREF) {
-			lua_pushvalue(_L, -2); // self
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, pluginRef); // self
 			++argCount;
 		}
 
 		for (size_t index = 0; index < paramsCount; ++index) {
-			const Property& paramType = paramTypes[index];
-			if (paramType.IsRef()) {
-				++refParamsCount;
-			}
-
-			using ParamConvertionFunc = decltype(&LuaLanguageModule::ParamToObject);
-			ParamConvertionFunc const convertFunc = paramType.IsRef() ? &LuaLanguageModule::ParamRefToObject : &LuaLanguageModule::ParamToObject;
-			const bool pushResult = (this->*convertFunc)(paramType, params, index);
-			if (!pushResult) {
-				SetFallbackReturn(retType.GetType(), ret);
+			const auto& [push, paramType] = plan.params[index];
+			if (!(this->*push)(*paramType, params, index)) {
+				lua_settop(_L, top);
+				(this->*plan.fallback)(ret);
 				return;
 			}
 		}
 
-		const bool hasRefParams = refParamsCount != 0;
-		const bool hasRet = retType.GetType() != ValueType::Void || hasRefParams;
-		const int returnCount = hasRet + refParamsCount;
+		const int returnCount = plan.returnCount;
 
-		if (lua_pcall(_L, argCount, returnCount, 0) != LUA_OK) {
+		const auto converted = timed ? CallStats::Clock::now() : start;
+		_marshalling = false;
+		limits.Enforce(true);
+		const int status = lua_pcall(_L, argCount, returnCount, 0);
+		limits.Enforce(false);
+		_marshalling = true;
+		const auto called = timed ? CallStats::Clock::now() : start;
+		CheckMemory(*context);
+
+		if (status != LUA_OK) {
 			LogError();
 			lua_pop(_L, 1);
-			SetFallbackReturn(retType.GetType(), ret);
+			(this->*plan.fallback)(ret);
 			return;
 		}
 
-		if (hasRefParams) {
-			int k = 0;
-
-			for (size_t index = 0; index < paramsCount; ++index) {
-				const Property& paramType = paramTypes[index];
-				if (!paramType.IsRef()) {
-					continue;
-				}
-				if (!SetRefParam(-returnCount + k + 1, paramType, params, index)) {
-					LogError();
-				}
-				if (++k == refParamsCount) {
-					break;
-				}
+		int arg = -returnCount + 1;
+		for (const auto& [set, index] : plan.refParams) {
+			if (!(this->*set)(arg++, params, index)) {
+				LogError();
 			}
 		}
 
-		if (!SetReturn(-returnCount, retType, ret)) {
+		if (!(this->*plan.ret)(-returnCount, *plan.retType, ret)) {
 			LogError();
-			SetFallbackReturn(retType.GetType(), ret);
+			(this->*plan.fallback)(ret);
 		}
 
 		lua_pop(_L, returnCount);
+
+		if (timed) {
+			plan.stats.Record(start, converted, called, CallStats::Clock::now());
+		}
 	}
 
 #pragma endregion InternalCall
 
-	Result<LuaMethodData> LuaLanguageModule::GenerateMethodExport(const Method& method, int pluginRef) {
+	Result<LuaFunction> LuaLanguageModule::ResolveMethodExport(const Method& method, int pluginRef) {
 		std::string_view className, methodName;
 		{
 			std::string_view funcName = method.GetFuncName();
@@ -2076,7 +2232,16 @@ namespace lualm {
 			lua_pop(_L, 1); // Pop instance
 		}
 
-		auto funcObj = std::make_unique<LuaFunction>(funcIsMethod ? pluginRef : LUA_NOREF, methodRef);
+		return LuaFunction{ funcIsMethod ? pluginRef : LUA_NOREF, methodRef };
+	}
+
+	Result<LuaLanguageModule::LuaMethodData> LuaLanguageModule::GenerateMethodExport(const Method& method, int pluginRef) {
+		Result<LuaFunction> function = ResolveMethodExport(method, pluginRef);
+		if (!function) {
+			return MakeError(std::move(function.error()));
+		}
+
+		auto funcObj = std::make_unique<LuaCallback>(_context, _context->allocator.GetOwner(), *function, CreateInternalPlan(method));
 
 		JitCallback callback{};
 		const Address methodAddr = callback.GetJitFunc(method, &detail::InternalCall, funcObj.get());
@@ -2089,602 +2254,241 @@ namespace lualm {
 
 #pragma region ExternalCall
 
-	LuaLanguageModule::ArgsScope::ArgsScope(size_t size) : params(size) {
-		storage.reserve(size);
+	LuaLanguageModule::ArgsScope::ArgsScope(const ExternalPlan& plan_, CallArena& arena_)
+		: params(plan_.hasHiddenParam + plan_.params.size())
+		, plan(plan_)
+		, arena(arena_)
+		, mark(arena_.GetMark()) {
+		if (plan.frameSize != 0) {
+			frame = static_cast<std::byte*>(arena.Allocate(plan.frameSize, plan.frameAlign));
+		}
 	}
 
-	void LuaLanguageModule::BeginExternalCall(ValueType retType, ArgsScope& a) const {
-		void* value;
-		switch (retType) {
-			case ValueType::String: {
-				value = &a.storage.emplace_back(plg::string{});
-				break;
-			}
-			case ValueType::Any: {
-				value = &a.storage.emplace_back(plg::any{});
-				break;
-			}
-			case ValueType::ArrayBool: {
-				value = &a.storage.emplace_back(plg::vector<bool>{});
-				break;
-			}
-			case ValueType::ArrayChar8: {
-				value = &a.storage.emplace_back(plg::vector<char>{});
-				break;
-			}
-			case ValueType::ArrayChar16: {
-				value = &a.storage.emplace_back(plg::vector<char16_t>{});
-				break;
-			}
-			case ValueType::ArrayInt8: {
-				value = &a.storage.emplace_back(plg::vector<int8_t>{});
-				break;
-			}
-			case ValueType::ArrayInt16: {
-				value = &a.storage.emplace_back(plg::vector<int16_t>{});
-				break;
-			}
-			case ValueType::ArrayInt32: {
-				value = &a.storage.emplace_back(plg::vector<int32_t>{});
-				break;
-			}
-			case ValueType::ArrayInt64: {
-				value = &a.storage.emplace_back(plg::vector<int64_t>{});
-				break;
-			}
-			case ValueType::ArrayUInt8: {
-				value = &a.storage.emplace_back(plg::vector<uint8_t>{});
-				break;
-			}
-			case ValueType::ArrayUInt16: {
-				value = &a.storage.emplace_back(plg::vector<uint16_t>{});
-				break;
+	LuaLanguageModule::ArgsScope::~ArgsScope() {
+		while (constructed != 0) {
+			const auto& [offset, destroy] = plan.slots[--constructed];
+			if (destroy) {
+				destroy(frame + offset);
 			}
-			case ValueType::ArrayUInt32: {
-				value = &a.storage.emplace_back(plg::vector<uint32_t>{});
-				break;
-			}
-			case ValueType::ArrayUInt64: {
-				value = &a.storage.emplace_back(plg::vector<uint64_t>{});
-				break;
-			}
-			case ValueType::ArrayPointer: {
-				value = &a.storage.emplace_back(plg::vector<void*>{});
-				break;
-			}
-			case ValueType::ArrayFloat: {
-				value = &a.storage.emplace_back(plg::vector<float>{});
-				break;
-			}
-			case ValueType::ArrayDouble: {
-				value = &a.storage.emplace_back(plg::vector<double>{});
-				break;
-			}
-			case ValueType::ArrayString: {
-				value = &a.storage.emplace_back(plg::vector<plg::string>{});
-				break;
-			}
-			case ValueType::ArrayAny: {
-				value = &a.storage.emplace_back(plg::vector<plg::any>{});
-				break;
-			}
-			case ValueType::ArrayVector2: {
-				value = &a.storage.emplace_back(plg::vector<plg::vec2>{});
-				break;
-			}
-			case ValueType::ArrayVector3: {
-				value = &a.storage.emplace_back(plg::vector<plg::vec3>{});
-				break;
-			}
-			case ValueType::ArrayVector4: {
-				value = &a.storage.emplace_back(plg::vector<plg::vec4>{});
-				break;
-			}
-			case ValueType::ArrayMatrix4x4: {
-				value = &a.storage.emplace_back(plg::vector<plg::mat4x4>{});
-				break;
-			}
-			case ValueType::Vector2: {
-				value = &a.storage.emplace_back(plg::vec2{});
-				break;
-			}
-			case ValueType::Vector3: {
-				value = &a.storage.emplace_back(plg::vec3{});
-				break;
-			}
-			case ValueType::Vector4: {
-				value = &a.storage.emplace_back(plg::vec4{});
-				break;
-			}
-			case ValueType::Matrix4x4: {
-				value = &a.storage.emplace_back(plg::mat4x4{});
-				break;
-			}
-			default:
-				_logger->Log(std::format(LOG_PREFIX "BeginExternalCall unsupported type {:#x}", static_cast<uint8_t>(retType)), Severity::Fatal);
-				std::terminate();
-				break;
 		}
+		arena.Rewind(mark);
+	}
 
-		a.params.Add(value);
+	template<typename T>
+	void LuaLanguageModule::BeginReturn(ArgsScope& a) {
+		a.params.Add(a.Emplace<T>());
 	}
 
-	bool LuaLanguageModule::MakeExternalCallWithObject(const Property& retType, JitCall::CallingFunc func, const ArgsScope& a, Return& ret) {
-		func(a.params.Get(), &ret);
-		switch (retType.GetType()) {
-			case ValueType::Void: {
-				return PushLuaObject();
-			}
-			case ValueType::Bool: {
-				const bool val = ret.Get<bool>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Char8: {
-				const char val = ret.Get<char>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Char16: {
-				const char16_t val = ret.Get<char16_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Int8: {
-				const int8_t val = ret.Get<int8_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Int16: {
-				const int16_t val = ret.Get<int16_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Int32: {
-				const int32_t val = ret.Get<int32_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Int64: {
-				const int64_t val = ret.Get<int64_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::UInt8: {
-				const uint8_t val = ret.Get<uint8_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::UInt16: {
-				const uint16_t val = ret.Get<uint16_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::UInt32: {
-				const uint32_t val = ret.Get<uint32_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::UInt64: {
-				const uint64_t val = ret.Get<uint64_t>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Pointer: {
-				void* val = ret.Get<void*>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Float: {
-				const float val = ret.Get<float>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Double: {
-				const double val = ret.Get<double>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Function: {
-				void* const val = ret.Get<void*>();
-				return PushOrCreateFunctionObject(*retType.GetPrototype(), val);
-			}
-			case ValueType::String: {
-				auto* const str = ret.Get<plg::string*>();
-				return PushLuaObject(*str);
-			}
-			case ValueType::Any: {
-				auto* const any = ret.Get<plg::any*>();
-				return PushLuaObject(*any);
-			}
-			case ValueType::ArrayBool: {
-				auto* const arr = ret.Get<plg::vector<bool>*>();
-				return PushLuaObjectList<bool>(*arr);
-			}
-			case ValueType::ArrayChar8: {
-				auto* const arr = ret.Get<plg::vector<char>*>();
-				return PushLuaObjectList<char>(*arr);
-			}
-			case ValueType::ArrayChar16: {
-				auto* const arr = ret.Get<plg::vector<char16_t>*>();
-				return PushLuaObjectList<char16_t>(*arr);
-			}
-			case ValueType::ArrayInt8: {
-				auto* const arr = ret.Get<plg::vector<int8_t>*>();
-				return PushLuaObjectList<int8_t>(*arr);
-			}
-			case ValueType::ArrayInt16: {
-				auto* const arr = ret.Get<plg::vector<int16_t>*>();
-				return PushLuaObjectList<int16_t>(*arr);
-			}
-			case ValueType::ArrayInt32: {
-				auto* const arr = ret.Get<plg::vector<int32_t>*>();
-				return PushLuaObjectList<int32_t>(*arr);
-			}
-			case ValueType::ArrayInt64: {
-				auto* const arr = ret.Get<plg::vector<int64_t>*>();
-				return PushLuaObjectList<int64_t>(*arr);
-			}
-			case ValueType::ArrayUInt8: {
-				auto* const arr = ret.Get<plg::vector<uint8_t>*>();
-				return PushLuaObjectList<uint8_t>(*arr);
-			}
-			case ValueType::ArrayUInt16: {
-				auto* const arr = ret.Get<plg::vector<uint16_t>*>();
-				return PushLuaObjectList<uint16_t>(*arr);
-			}
-			case ValueType::ArrayUInt32: {
-				auto* const arr = ret.Get<plg::vector<uint32_t>*>();
-				return PushLuaObjectList<uint32_t>(*arr);
-			}
-			case ValueType::ArrayUInt64: {
-				auto* const arr = ret.Get<plg::vector<uint64_t>*>();
-				return PushLuaObjectList<uint64_t>(*arr);
-			}
-			case ValueType::ArrayPointer: {
-				auto* const arr = ret.Get<plg::vector<void*>*>();
-				return PushLuaObjectList<void*>(*arr);
-			}
-			case ValueType::ArrayFloat: {
-				auto* const arr = ret.Get<plg::vector<float>*>();
-				return PushLuaObjectList<float>(*arr);
-			}
-			case ValueType::ArrayDouble: {
-				auto* const arr = ret.Get<plg::vector<double>*>();
-				return PushLuaObjectList<double>(*arr);
-			}
-			case ValueType::ArrayString: {
-				auto* const arr = ret.Get<plg::vector<plg::string>*>();
-				return PushLuaObjectList<plg::string>(*arr);
-			}
-			case ValueType::ArrayAny: {
-				auto* const arr = ret.Get<plg::vector<plg::any>*>();
-				return PushLuaObjectList<plg::any>(*arr);
-			}
-			case ValueType::ArrayVector2: {
-				auto* const arr = ret.Get<plg::vector<plg::vec2>*>();
-				return PushLuaObjectList<plg::vec2>(*arr);
-			}
-			case ValueType::ArrayVector3: {
-				auto* const arr = ret.Get<plg::vector<plg::vec3>*>();
-				return PushLuaObjectList<plg::vec3>(*arr);
-			}
-			case ValueType::ArrayVector4: {
-				auto* const arr = ret.Get<plg::vector<plg::vec4>*>();
-				return PushLuaObjectList<plg::vec4>(*arr);
-			}
-			case ValueType::ArrayMatrix4x4: {
-				auto* const arr = ret.Get<plg::vector<plg::mat4x4>*>();
-				return PushLuaObjectList<plg::mat4x4>(*arr);
-			}
-			case ValueType::Vector2: {
-				const plg::vec2 val = ret.Get<plg::vec2>();
-				return PushLuaObject(val);
-			}
-			case ValueType::Vector3: {
-				plg::vec3 val;
-				if (ValueUtils::IsHiddenParam(retType.GetType())) {
-					val = *ret.Get<plg::vec3*>();
-				} else {
-					val = ret.Get<plg::vec3>();
-				}
-				return PushLuaObject(val);
-			}
-			case ValueType::Vector4: {
-				plg::vec4 val;
-				if (ValueUtils::IsHiddenParam(retType.GetType())) {
-					val = *ret.Get<plg::vec4*>();
-				} else {
-					val = ret.Get<plg::vec4>();
-				}
-				return PushLuaObject(val);
+	template<typename T>
+	bool LuaLanguageModule::PushValueParam(const Property&, int arg, ArgsScope& a) {
+		auto value = ValueFromObject<T>(arg);
+		if (!value) {
+			return false;
+		}
+		a.params.Add(*value);
+		return true;
+	}
+
+	template<typename T>
+	bool LuaLanguageModule::PushStorageParam(const Property&, int arg, ArgsScope& a) {
+		if constexpr (is_buffer_vector_v<T>) {
+			// A buffer is passed as is: it stays anchored on the Lua stack for the
+			// duration of the call and ref writes land in it directly. The slot
+			// still gets an (empty) value so the frame layout stays positional.
+			if (auto* buffer = TestBuffer<typename T::value_type>(_L, arg)) {
+				a.Emplace<T>();
+				a.params.Add(buffer);
+				return true;
 			}
-			case ValueType::Matrix4x4: {
-				plg::mat4x4 val = *ret.Get<plg::mat4x4*>();
-				return PushLuaObject(val);
+		}
+		auto value = ObjectToValue<T>(arg);
+		if (!value) {
+			return false;
+		}
+		a.params.Add(a.Emplace<T>(std::move(*value)));
+		return true;
+	}
+
+	bool LuaLanguageModule::PushStringParam(const Property&, int arg, ArgsScope& a) {
+		// The native side takes a plg::string*, so the string is built straight
+		// in its slot from the Lua buffer: one copy, no heap for SSO-sized values
+		size_t length{};
+		const char* str = lua_tolstring(_L, arg, &length);
+		if (!str) {
+			luaL_typeerror(_L, arg, lua_typename(_L, LUA_TSTRING));
+			return false;
+		}
+		a.params.Add(a.Emplace<plg::string>(str, length));
+		return true;
+	}
+
+	bool LuaLanguageModule::PushFunctionParam(const Property& paramType, int arg, ArgsScope& a) {
+		auto value = GetOrCreateFunctionValue(*paramType.GetPrototype(), arg);
+		if (!value) {
+			return false;
+		}
+		a.params.Add(*value);
+		return true;
+	}
+
+	bool LuaLanguageModule::PushUnsupportedParam(const Property& paramType, int, ArgsScope&) {
+		luaL_error(_L, "PushParam unsupported type %d", static_cast<int>(paramType.GetType()));
+		return false;
+	}
+
+	template<typename T>
+	bool LuaLanguageModule::PushStorageObject(const ArgsScope& a, size_t slot, int arg) {
+		if constexpr (is_buffer_vector_v<T>) {
+			if (TestBuffer<typename T::value_type>(_L, arg)) {
+				lua_pushvalue(_L, arg);
+				return true;
 			}
-			default:
-				luaL_error(_L, "MakeExternalCallWithObject unsupported type %d", static_cast<int>(retType.GetType()));
-				return false;
 		}
+		return PushObject(a.Get<T>(slot));
 	}
 
-	bool LuaLanguageModule::PushObjectAsParam(const Property& paramType, int arg, ArgsScope& a) {
-		const auto PushValParam = [&a](auto&& value) {
-			if (!value) {
-				return false;
+	template<typename T>
+	bool LuaLanguageModule::PushReturnValue(const Property&, Return& ret) {
+		return PushObject(ret.Get<T>());
+	}
+
+	template<typename T>
+	bool LuaLanguageModule::PushReturnPointer(const Property&, Return& ret) {
+		// Hidden return: the callee hands back the address of our storage slot
+		if constexpr (is_buffer_vector_v<T>) {
+			const auto& enabled = _context->bufferReturns;
+			if (const uint32_t owner = _context->allocator.GetOwner(); owner < enabled.size() && enabled[owner]) {
+				PushBuffer(_L, std::move(*ret.Get<T*>()));
+				return true;
 			}
-			a.params.Add(*value);
-			return true;
-		};
-		const auto PushRefParam = [&a](auto&& value) {
-			if (!value) {
-				return false;
+		}
+		return PushObject(*ret.Get<T*>());
+	}
+
+	bool LuaLanguageModule::PushReturnVoid(const Property&, Return&) {
+		return PushLuaObject();
+	}
+
+	bool LuaLanguageModule::PushReturnFunction(const Property& retType, Return& ret) {
+		void* const val = ret.Get<void*>();
+		return PushOrCreateFunctionObject(*retType.GetPrototype(), val);
+	}
+
+	bool LuaLanguageModule::PushReturnUnsupported(const Property& retType, Return&) {
+		luaL_error(_L, "PushReturn unsupported type %d", static_cast<int>(retType.GetType()));
+		return false;
+	}
+
+	LuaLanguageModule::PushParamFunc LuaLanguageModule::GetPushParamFunc(const Property& paramType) {
+		const ValueType type = paramType.GetType();
+		const bool isRef = paramType.IsRef();
+		if (type == ValueType::Function) {
+			return isRef ? &LuaLanguageModule::PushUnsupportedParam : &LuaLanguageModule::PushFunctionParam;
+		}
+		if (type == ValueType::String && !isRef) {
+			return &LuaLanguageModule::PushStringParam;
+		}
+		const auto func = VisitValueType(type, [isRef]<typename T>() -> PushParamFunc {
+			if constexpr (IsPassedByValue<T>()) {
+				if (!isRef) {
+					return &LuaLanguageModule::PushValueParam<T>;
+				}
 			}
-			a.params.Add(&a.storage.emplace_back(*value));
-			return true;
-		};
+			return &LuaLanguageModule::PushStorageParam<T>;
+		});
+		return func ? func : &LuaLanguageModule::PushUnsupportedParam;
+	}
 
-		switch (paramType.GetType()) {
-			case ValueType::Bool:
-				return PushValParam(ValueFromObject<bool>(arg));
-			case ValueType::Char8:
-				return PushValParam(ValueFromObject<char>(arg));
-			case ValueType::Char16:
-				return PushValParam(ValueFromObject<char16_t>(arg));
-			case ValueType::Int8:
-				return PushValParam(ValueFromObject<int8_t>(arg));
-			case ValueType::Int16:
-				return PushValParam(ValueFromObject<int16_t>(arg));
-			case ValueType::Int32:
-				return PushValParam(ValueFromObject<int32_t>(arg));
-			case ValueType::Int64:
-				return PushValParam(ValueFromObject<int64_t>(arg));
-			case ValueType::UInt8:
-				return PushValParam(ValueFromObject<uint8_t>(arg));
-			case ValueType::UInt16:
-				return PushValParam(ValueFromObject<uint16_t>(arg));
-			case ValueType::UInt32:
-				return PushValParam(ValueFromObject<uint32_t>(arg));
-			case ValueType::UInt64:
-				return PushValParam(ValueFromObject<uint64_t>(arg));
-			case ValueType::Pointer:
-				return PushValParam(ValueFromObject<void*>(arg));
-			case ValueType::Float:
-				return PushValParam(ValueFromObject<float>(arg));
-			case ValueType::Double:
-				return PushValParam(ValueFromObject<double>(arg));
-			case ValueType::String:
-				return PushRefParam(ValueFromObject<plg::string>(arg));
-			case ValueType::Any:
-				return PushRefParam(ValueFromObject<plg::any>(arg));
+	LuaLanguageModule::PushReturnFunc LuaLanguageModule::GetPushReturnFunc(const Property& retType) {
+		const ValueType type = retType.GetType();
+		switch (type) {
+			case ValueType::Void:
+				return &LuaLanguageModule::PushReturnVoid;
 			case ValueType::Function:
-				return PushValParam(GetOrCreateFunctionValue(*paramType.GetPrototype(), arg));
-			case ValueType::ArrayBool:
-				return PushRefParam(ArrayFromObject<bool>(arg));
-			case ValueType::ArrayChar8:
-				return PushRefParam(ArrayFromObject<char>(arg));
-			case ValueType::ArrayChar16:
-				return PushRefParam(ArrayFromObject<char16_t>(arg));
-			case ValueType::ArrayInt8:
-				return PushRefParam(ArrayFromObject<int8_t>(arg));
-			case ValueType::ArrayInt16:
-				return PushRefParam(ArrayFromObject<int16_t>(arg));
-			case ValueType::ArrayInt32:
-				return PushRefParam(ArrayFromObject<int32_t>(arg));
-			case ValueType::ArrayInt64:
-				return PushRefParam(ArrayFromObject<int64_t>(arg));
-			case ValueType::ArrayUInt8:
-				return PushRefParam(ArrayFromObject<uint8_t>(arg));
-			case ValueType::ArrayUInt16:
-				return PushRefParam(ArrayFromObject<uint16_t>(arg));
-			case ValueType::ArrayUInt32:
-				return PushRefParam(ArrayFromObject<uint32_t>(arg));
-			case ValueType::ArrayUInt64:
-				return PushRefParam(ArrayFromObject<uint64_t>(arg));
-			case ValueType::ArrayPointer:
-				return PushRefParam(ArrayFromObject<void*>(arg));
-			case ValueType::ArrayFloat:
-				return PushRefParam(ArrayFromObject<float>(arg));
-			case ValueType::ArrayDouble:
-				return PushRefParam(ArrayFromObject<double>(arg));
-			case ValueType::ArrayString:
-				return PushRefParam(ArrayFromObject<plg::string>(arg));
-			case ValueType::ArrayAny:
-				return PushRefParam(ArrayFromObject<plg::any>(arg));
-			case ValueType::ArrayVector2:
-				return PushRefParam(ArrayFromObject<plg::vec2>(arg));
-			case ValueType::ArrayVector3:
-				return PushRefParam(ArrayFromObject<plg::vec3>(arg));
-			case ValueType::ArrayVector4:
-				return PushRefParam(ArrayFromObject<plg::vec4>(arg));
-			case ValueType::ArrayMatrix4x4:
-				return PushRefParam(ArrayFromObject<plg::mat4x4>(arg));
-			case ValueType::Vector2:
-				return PushRefParam(ValueFromObject<plg::vec2>(arg));
-			case ValueType::Vector3:
-				return PushRefParam(ValueFromObject<plg::vec3>(arg));
-			case ValueType::Vector4:
-				return PushRefParam(ValueFromObject<plg::vec4>(arg));
-			case ValueType::Matrix4x4:
-				return PushRefParam(ValueFromObject<plg::mat4x4>(arg));
+				return &LuaLanguageModule::PushReturnFunction;
 			default:
-				luaL_error(_L, "PushObjectAsParam unsupported type %d", static_cast<int>(paramType.GetType()));
-				return {};
+				break;
 		}
+		const bool hidden = ValueUtils::IsHiddenParam(type);
+		const auto func = VisitValueType(type, [hidden]<typename T>() -> PushReturnFunc {
+			if (hidden) {
+				return &LuaLanguageModule::PushReturnPointer<T>;
+			}
+			if constexpr (std::is_trivially_copyable_v<T>) {
+				return &LuaLanguageModule::PushReturnValue<T>;
+			} else {
+				return nullptr;
+			}
+		});
+		return func ? func : &LuaLanguageModule::PushReturnUnsupported;
 	}
 
-	bool LuaLanguageModule::PushObjectAsRefParam(const Property& paramType, int arg, ArgsScope& a) {
-		const auto PushRefParam = [&a](auto&& value) {
-			if (!value) {
-				return false;
-			}
-			a.params.Add(&a.storage.emplace_back(*value));
-			return true;
+	std::unique_ptr<LuaLanguageModule::ExternalPlan> LuaLanguageModule::CreateExternalPlan(const Method& method, JitCall::CallingFunc func) {
+		const auto& retType = method.GetRetType();
+		const auto& paramTypes = method.GetParamTypes();
+
+		auto plan = std::make_unique<ExternalPlan>();
+		plan->method = &method;
+		plan->zoneName = std::format("lua::{}", method.GetName());
+		plan->func = func;
+		plan->retType = &retType;
+		plan->ret = GetPushReturnFunc(retType);
+		plan->hasHiddenParam = ValueUtils::IsHiddenParam(retType.GetType());
+		plan->params.reserve(paramTypes.size());
+
+		// Storage slots are laid out in argument order: hidden return first,
+		// then every parameter that is passed through a pointer
+		const auto AddSlot = [&plan](ValueType type) {
+			return VisitValueType(type, [&plan]<typename T>() {
+				const size_t offset = (plan->frameSize + alignof(T) - 1) & ~(alignof(T) - 1);
+				void (*destroy)(void*) = nullptr;
+				if constexpr (!std::is_trivially_destructible_v<T>) {
+					destroy = [](void* value) { std::destroy_at(static_cast<T*>(value)); };
+				}
+				plan->slots.emplace_back(offset, destroy);
+				plan->frameSize = offset + sizeof(T);
+				plan->frameAlign = std::max(plan->frameAlign, alignof(T));
+				return true;
+			});
 		};
 
-		switch (paramType.GetType()) {
-			case ValueType::Bool:
-				return PushRefParam(ValueFromObject<bool>(arg));
-			case ValueType::Char8:
-				return PushRefParam(ValueFromObject<char>(arg));
-			case ValueType::Char16:
-				return PushRefParam(ValueFromObject<char16_t>(arg));
-			case ValueType::Int8:
-				return PushRefParam(ValueFromObject<int8_t>(arg));
-			case ValueType::Int16:
-				return PushRefParam(ValueFromObject<int16_t>(arg));
-			case ValueType::Int32:
-				return PushRefParam(ValueFromObject<int32_t>(arg));
-			case ValueType::Int64:
-				return PushRefParam(ValueFromObject<int64_t>(arg));
-			case ValueType::UInt8:
-				return PushRefParam(ValueFromObject<uint8_t>(arg));
-			case ValueType::UInt16:
-				return PushRefParam(ValueFromObject<uint16_t>(arg));
-			case ValueType::UInt32:
-				return PushRefParam(ValueFromObject<uint32_t>(arg));
-			case ValueType::UInt64:
-				return PushRefParam(ValueFromObject<uint64_t>(arg));
-			case ValueType::Pointer:
-				return PushRefParam(ValueFromObject<void*>(arg));
-			case ValueType::Float:
-				return PushRefParam(ValueFromObject<float>(arg));
-			case ValueType::Double:
-				return PushRefParam(ValueFromObject<double>(arg));
-			case ValueType::String:
-				return PushRefParam(ValueFromObject<plg::string>(arg));
-			case ValueType::Any:
-				return PushRefParam(ValueFromObject<plg::any>(arg));
-			case ValueType::ArrayBool:
-				return PushRefParam(ArrayFromObject<bool>(arg));
-			case ValueType::ArrayChar8:
-				return PushRefParam(ArrayFromObject<char>(arg));
-			case ValueType::ArrayChar16:
-				return PushRefParam(ArrayFromObject<char16_t>(arg));
-			case ValueType::ArrayInt8:
-				return PushRefParam(ArrayFromObject<int8_t>(arg));
-			case ValueType::ArrayInt16:
-				return PushRefParam(ArrayFromObject<int16_t>(arg));
-			case ValueType::ArrayInt32:
-				return PushRefParam(ArrayFromObject<int32_t>(arg));
-			case ValueType::ArrayInt64:
-				return PushRefParam(ArrayFromObject<int64_t>(arg));
-			case ValueType::ArrayUInt8:
-				return PushRefParam(ArrayFromObject<uint8_t>(arg));
-			case ValueType::ArrayUInt16:
-				return PushRefParam(ArrayFromObject<uint16_t>(arg));
-			case ValueType::ArrayUInt32:
-				return PushRefParam(ArrayFromObject<uint32_t>(arg));
-			case ValueType::ArrayUInt64:
-				return PushRefParam(ArrayFromObject<uint64_t>(arg));
-			case ValueType::ArrayPointer:
-				return PushRefParam(ArrayFromObject<void*>(arg));
-			case ValueType::ArrayFloat:
-				return PushRefParam(ArrayFromObject<float>(arg));
-			case ValueType::ArrayDouble:
-				return PushRefParam(ArrayFromObject<double>(arg));
-			case ValueType::ArrayString:
-				return PushRefParam(ArrayFromObject<plg::string>(arg));
-			case ValueType::ArrayAny:
-				return PushRefParam(ArrayFromObject<plg::any>(arg));
-			case ValueType::ArrayVector2:
-				return PushRefParam(ArrayFromObject<plg::vec2>(arg));
-			case ValueType::ArrayVector3:
-				return PushRefParam(ArrayFromObject<plg::vec3>(arg));
-			case ValueType::ArrayVector4:
-				return PushRefParam(ArrayFromObject<plg::vec4>(arg));
-			case ValueType::ArrayMatrix4x4:
-				return PushRefParam(ArrayFromObject<plg::mat4x4>(arg));
-			case ValueType::Vector2:
-				return PushRefParam(ValueFromObject<plg::vec2>(arg));
-			case ValueType::Vector3:
-				return PushRefParam(ValueFromObject<plg::vec3>(arg));
-			case ValueType::Vector4:
-				return PushRefParam(ValueFromObject<plg::vec4>(arg));
-			case ValueType::Matrix4x4:
-				return PushRefParam(ValueFromObject<plg::mat4x4>(arg));
-			default:
-				luaL_error(_L, "PushObjectAsRefParam unsupported enum type %d", static_cast<int>(paramType.GetType()));
-				return {};
-		}
-	}
-
-	bool LuaLanguageModule::StorageValueToObject(const Property& paramType, const ArgsScope& a, size_t index) {
-		switch (paramType.GetType()) {
-			case ValueType::Bool:
-				return PushLuaObject(plg::get<bool>(a.storage[index]));
-			case ValueType::Char8:
-				return PushLuaObject(plg::get<char>(a.storage[index]));
-			case ValueType::Char16:
-				return PushLuaObject(plg::get<char16_t>(a.storage[index]));
-			case ValueType::Int8:
-				return PushLuaObject(plg::get<int8_t>(a.storage[index]));
-			case ValueType::Int16:
-				return PushLuaObject(plg::get<int16_t>(a.storage[index]));
-			case ValueType::Int32:
-				return PushLuaObject(plg::get<int32_t>(a.storage[index]));
-			case ValueType::Int64:
-				return PushLuaObject(plg::get<int64_t>(a.storage[index]));
-			case ValueType::UInt8:
-				return PushLuaObject(plg::get<uint8_t>(a.storage[index]));
-			case ValueType::UInt16:
-				return PushLuaObject(plg::get<uint16_t>(a.storage[index]));
-			case ValueType::UInt32:
-				return PushLuaObject(plg::get<uint32_t>(a.storage[index]));
-			case ValueType::UInt64:
-				return PushLuaObject(plg::get<uint64_t>(a.storage[index]));
-			case ValueType::Float:
-				return PushLuaObject(plg::get<float>(a.storage[index]));
-			case ValueType::Double:
-				return PushLuaObject(plg::get<double>(a.storage[index]));
-			case ValueType::String:
-				return PushLuaObject(plg::get<plg::string>(a.storage[index]));
-			case ValueType::Any:
-				return PushLuaObject(plg::get<plg::any>(a.storage[index]));
-			case ValueType::Pointer:
-				return PushLuaObject(plg::get<void*>(a.storage[index]));
-			case ValueType::ArrayBool:
-				return PushLuaObjectList(plg::get<plg::vector<bool>>(a.storage[index]));
-			case ValueType::ArrayChar8:
-				return PushLuaObjectList(plg::get<plg::vector<char>>(a.storage[index]));
-			case ValueType::ArrayChar16:
-				return PushLuaObjectList(plg::get<plg::vector<char16_t>>(a.storage[index]));
-			case ValueType::ArrayInt8:
-				return PushLuaObjectList(plg::get<plg::vector<int8_t>>(a.storage[index]));
-			case ValueType::ArrayInt16:
-				return PushLuaObjectList(plg::get<plg::vector<int16_t>>(a.storage[index]));
-			case ValueType::ArrayInt32:
-				return PushLuaObjectList(plg::get<plg::vector<int32_t>>(a.storage[index]));
-			case ValueType::ArrayInt64:
-				return PushLuaObjectList(plg::get<plg::vector<int64_t>>(a.storage[index]));
-			case ValueType::ArrayUInt8:
-				return PushLuaObjectList(plg::get<plg::vector<uint8_t>>(a.storage[index]));
-			case ValueType::ArrayUInt16:
-				return PushLuaObjectList(plg::get<plg::vector<uint16_t>>(a.storage[index]));
-			case ValueType::ArrayUInt32:
-				return PushLuaObjectList(plg::get<plg::vector<uint32_t>>(a.storage[index]));
-			case ValueType::ArrayUInt64:
-				return PushLuaObjectList(plg::get<plg::vector<uint64_t>>(a.storage[index]));
-			case ValueType::ArrayPointer:
-				return PushLuaObjectList(plg::get<plg::vector<void*>>(a.storage[index]));
-			case ValueType::ArrayFloat:
-				return PushLuaObjectList(plg::get<plg::vector<float>>(a.storage[index]));
-			case ValueType::ArrayDouble:
-				return PushLuaObjectList(plg::get<plg::vector<double>>(a.storage[index]));
-			case ValueType::ArrayString:
-				return PushLuaObjectList(plg::get<plg::vector<plg::string>>(a.storage[index]));
-			case ValueType::ArrayAny:
-				return PushLuaObjectList(plg::get<plg::vector<plg::any>>(a.storage[index]));
-			case ValueType::ArrayVector2:
-				return PushLuaObjectList(plg::get<plg::vector<plg::vec2>>(a.storage[index]));
-			case ValueType::ArrayVector3:
-				return PushLuaObjectList(plg::get<plg::vector<plg::vec3>>(a.storage[index]));
-			case ValueType::ArrayVector4:
-				return PushLuaObjectList(plg::get<plg::vector<plg::vec4>>(a.storage[index]));
-			case ValueType::ArrayMatrix4x4:
-				return PushLuaObjectList(plg::get<plg::vector<plg::mat4x4>>(a.storage[index]));
-			case ValueType::Vector2:
-				return PushLuaObject(plg::get<plg::vec2>(a.storage[index]));
-			case ValueType::Vector3:
-				return PushLuaObject(plg::get<plg::vec3>(a.storage[index]));
-			case ValueType::Vector4:
-				return PushLuaObject(plg::get<plg::vec4>(a.storage[index]));
-			case ValueType::Matrix4x4:
-				return PushLuaObject(plg::get<plg::mat4x4>(a.storage[index]));
-			default:
-				luaL_error(_L, "StorageValueToObject unsupported type %d", static_cast<int>(paramType.GetType()));
-				return false;
+		if (plan->hasHiddenParam) {
+			plan->begin = VisitValueType(retType.GetType(), []<typename T>() -> BeginReturnFunc {
+				return &LuaLanguageModule::BeginReturn<T>;
+			});
+			if (!plan->begin) {
+				_logger->Log(std::format(LOG_PREFIX "CreateExternalPlan unsupported return type {:#x}", static_cast<uint8_t>(retType.GetType())), Severity::Fatal);
+				std::terminate();
+			}
+			AddSlot(retType.GetType());
+		}
+
+		for (const auto& paramType : paramTypes) {
+			plan->params.emplace_back(GetPushParamFunc(paramType), &paramType);
+
+			const bool byRef = paramType.IsRef();
+			const bool stored = byRef || VisitValueType(paramType.GetType(), []<typename T>() {
+				return !IsPassedByValue<T>();
+			});
+
+			if (byRef) {
+				const auto push = VisitValueType(paramType.GetType(), []<typename T>() -> PushStorageFunc {
+					return &LuaLanguageModule::PushStorageObject<T>;
+				});
+				if (push) {
+					plan->refParams.emplace_back(push, plan->slots.size(), plan->params.size() - 1);
+				}
+			}
+
+			if (stored) {
+				AddSlot(paramType.GetType());
+			}
 		}
+
+		return plan;
 	}
 
-	ScopedZone LuaLanguageModule::TraceCall(std::string_view methodName) const {
+	ScopedZone LuaLanguageModule::TraceCall(const ExternalPlan& plan) const {
 		ScopedZone zone;
 
 		lua_Debug ar;
@@ -2701,126 +2505,376 @@ namespace lualm {
 			const Location location(line, 0, fileName, functionName, moduleName);
 
 			if (const auto& profiler = _profiler) {
-				zone = ScopedZone(profiler, std::format("{}::{}", moduleName, methodName), location);
+				zone = ScopedZone(profiler, plan.zoneName, location);
 			}
 
-			if (const auto& logger = _logger/*; logger && logger->GetLogLevel() <= Severity::Debug*/) {
-				logger->Log(methodName, Severity::Trace, location);
+			if (const auto& logger = _logger; logger && logger->GetLogLevel() >= Severity::Trace) {
+				logger->Log(plan.method->GetName(), Severity::Trace, location);
 			}
 		}
 
 		return zone;
 	}
 
-	void LuaLanguageModule::ExternalCall(const Method& method, Address data, uint64_t* parameters, size_t count, void* return_) {
-		[[maybe_unused]] const auto zone = TraceCall(method.GetName());
+	void LuaLanguageModule::SetBufferReturns(lua_State* L, bool enable) {
+		// Plugins are told apart by the allocator owner charged for their code
+		LuaContext& context = *GetContext(L);
+		auto& enabled = context.bufferReturns;
+		const uint32_t owner = context.allocator.GetOwner();
+		if (owner >= enabled.size()) {
+			enabled.resize(owner + 1);
+		}
+		enabled[owner] = enable;
+	}
 
-		ParametersSpan params(parameters, count);
-		ReturnSlot ret(return_, ValueUtils::SizeOf(ValueType::Int32));
+	bool LuaLanguageModule::StartSampling(std::chrono::microseconds interval, int instructions) {
+		if (_sampler) {
+			return false;
+		}
+		_sampler = std::make_unique<SamplingProfiler>(interval);
+		_samplerInstructions = instructions;
+		for (const auto& context : _contexts) {
+			context->sampler = _sampler.get();
+			lua_sethook(context->L, &SampleHook, LUA_MASKCOUNT, instructions);
+		}
+		return true;
+	}
 
-		// int (MethodLuaCall*)(lua_State* L)
-		assert(params.Get<lua_State*>(0) == _L);
+	std::optional<fs::path> LuaLanguageModule::StopSampling() {
+		if (!_sampler) {
+			return std::nullopt;
+		}
+		for (const auto& context : _contexts) {
+			lua_sethook(context->L, nullptr, 0, 0);
+			context->sampler = nullptr;
+		}
+		const auto sampler = std::move(_sampler);
 
-		const auto& paramTypes = method.GetParamTypes();
-		const size_t paramCount = paramTypes.size();
+		const auto now = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+		fs::path path = _provider->GetLogsDir() / std::format("lua-profile-{:%Y%m%d-%H%M%S}.folded", now);
+		if (!sampler->Write(path)) {
+			_logger->Log(std::format(LOG_PREFIX "Failed to write profile to '{}'", plg::as_string(path)), Severity::Warning);
+			return std::nullopt;
+		}
+		_logger->Log(std::format(LOG_PREFIX "Wrote {} samples to '{}'", sampler->GetSampleCount(), plg::as_string(path)), Severity::Info);
+		return path;
+	}
+
+	bool LuaLanguageModule::StartAllocationProfiler(size_t sampleRate) {
+		if (_allocProfiler) {
+			return false;
+		}
+		_allocProfiler = std::make_unique<AllocationProfiler>(sampleRate);
+		for (const auto& context : _contexts) {
+			context->allocator.SetSampling(sampleRate, &SampleAllocation, context.get());
+		}
+		return true;
+	}
+
+	std::optional<fs::path> LuaLanguageModule::StopAllocationProfiler() {
+		if (!_allocProfiler) {
+			return std::nullopt;
+		}
+		for (const auto& context : _contexts) {
+			context->allocator.SetSampling(0, nullptr, nullptr);
+		}
+		const auto profiler = std::move(_allocProfiler);
+
+		const auto now = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+		fs::path path = _provider->GetLogsDir() / std::format("lua-alloc-{:%Y%m%d-%H%M%S}.txt", now);
+		if (!profiler->Write(path)) {
+			_logger->Log(std::format(LOG_PREFIX "Failed to write allocation profile to '{}'", plg::as_string(path)), Severity::Warning);
+			return std::nullopt;
+		}
+		_logger->Log(std::format(LOG_PREFIX "Wrote {} allocation samples to '{}'", profiler->GetSampleCount(), plg::as_string(path)), Severity::Info);
+		return path;
+	}
+
+	void LuaLanguageModule::RecordAllocation(LuaContext& context, int kind, size_t size, size_t samples) {
+		// The allocator does not know the running thread. The thread that last
+		// entered the state from native code is the best guess, coroutines
+		// resumed from Lua are charged to the resume site.
+		lua_State* L = _context == &context ? _L : context.L;
+		_allocProfiler->Record(L, kind, size, samples, _marshalling);
+
+		// lua_sethook is safe to call from anywhere, the stack is walked once the
+		// next instruction runs
+		lua_sethook(L, &AllocationHook, LUA_MASKCOUNT, 1);
+	}
+
+	void LuaLanguageModule::ResolveAllocations(lua_State* L) {
+		if (_allocProfiler) {
+			_allocProfiler->Resolve(L);
+		}
+
+		// Give the hook back to the Lua profiler if it runs
+		if (GetContext(L)->sampler) {
+			lua_sethook(L, &SampleHook, LUA_MASKCOUNT, _samplerInstructions);
+		} else {
+			lua_sethook(L, nullptr, 0, 0);
+		}
+	}
+
+	bool LuaLanguageModule::StartTimeline(size_t capacity) {
+		if (_timeline) {
+			return false;
+		}
+		_timeline = std::make_unique<TimelineRecorder>(capacity);
+		return true;
+	}
+
+	std::optional<fs::path> LuaLanguageModule::FlushTimeline() const {
+		if (!_timeline) {
+			return std::nullopt;
+		}
+
+		const auto now = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+		fs::path path = _provider->GetLogsDir() / std::format("lua-timeline-{:%Y%m%d-%H%M%S}.json", now);
+		if (!_timeline->Write(path)) {
+			_logger->Log(std::format(LOG_PREFIX "Failed to write timeline to '{}'", plg::as_string(path)), Severity::Warning);
+			return std::nullopt;
+		}
+		const uint64_t count = _timeline->GetEventCount();
+		const uint64_t lost = count > _timeline->GetCapacity() ? count - _timeline->GetCapacity() : 0;
+		_logger->Log(std::format(LOG_PREFIX "Wrote timeline of {} events to '{}' ({} overwritten)", count - lost, plg::as_string(path), lost), Severity::Info);
+		return path;
+	}
+
+	std::optional<fs::path> LuaLanguageModule::StopTimeline() {
+		auto path = FlushTimeline();
+		_timeline.reset();
+		return path;
+	}
+
+	std::vector<LuaLanguageModule::StatsEntry> LuaLanguageModule::CollectStats() const {
+		std::vector<StatsEntry> entries;
+		auto add = [&](const Method* method, const char* kind, const CallStats& stats) {
+			if (stats.calls != 0) {
+				entries.emplace_back(method->GetName(), kind, &stats);
+			}
+		};
+		for (const auto& [_, plan] : _moduleFunctions) {
+			add(plan->method, "import", plan->stats);
+		}
+		for (const auto& [_, holder] : _externalFunctions) {
+			add(holder.plan->method, "import", holder.plan->stats);
+		}
+		for (const auto& [_, callback] : _luaMethods) {
+			add(callback->plan.method, "export", callback->plan.stats);
+		}
+		for (const auto& [_, data] : _internalFunctions) {
+			add(data.luaCallback->plan.method, "callback", data.luaCallback->plan.stats);
+		}
+		std::ranges::sort(entries, std::greater{}, [](const StatsEntry& entry) { return entry.stats->total; });
+		return entries;
+	}
+
+	// Array of { name, kind, calls, total, max, convert, body, result }, sorted by
+	// total time, times in microseconds
+	void LuaLanguageModule::PushStats(lua_State* L) const {
+		using Micros = std::chrono::duration<lua_Number, std::micro>;
+
+		const auto entries = CollectStats();
+		lua_createtable(L, static_cast<int>(entries.size()), 0);
+		for (size_t i = 0; i < entries.size(); ++i) {
+			const auto& [name, kind, stats] = entries[i];
+			lua_createtable(L, 0, 8);
+			lua_pushlstring(L, name.data(), name.size());
+			lua_setfield(L, -2, "name");
+			lua_pushstring(L, kind);
+			lua_setfield(L, -2, "kind");
+			lua_pushinteger(L, static_cast<lua_Integer>(stats->calls));
+			lua_setfield(L, -2, "calls");
+			lua_pushnumber(L, Micros(stats->total).count());
+			lua_setfield(L, -2, "total");
+			lua_pushnumber(L, Micros(stats->max).count());
+			lua_setfield(L, -2, "max");
+			lua_pushnumber(L, Micros(stats->convert).count());
+			lua_setfield(L, -2, "convert");
+			lua_pushnumber(L, Micros(stats->body).count());
+			lua_setfield(L, -2, "body");
+			lua_pushnumber(L, Micros(stats->result).count());
+			lua_setfield(L, -2, "result");
+			lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+		}
+	}
+
+	// Rewrites <logs>/lua-call-stats.txt with the counters so far
+	void LuaLanguageModule::DumpStats() const {
+		using Micros = std::chrono::duration<double, std::micro>;
+
+		const fs::path path = _provider->GetLogsDir() / "lua-call-stats.txt";
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			_logger->Log(std::format(LOG_PREFIX "Failed to write call stats to '{}'", plg::as_string(path)), Severity::Warning);
+			return;
+		}
+
+		file << std::format("{:<48} {:<8} {:>12} {:>14} {:>12} {:>14} {:>14} {:>14}\n", "function", "kind", "calls", "total us", "max us", "convert us", "body us", "result us");
+		for (const auto& [name, kind, stats] : CollectStats()) {
+			file << std::format("{:<48} {:<8} {:>12} {:>14.1f} {:>12.1f} {:>14.1f} {:>14.1f} {:>14.1f}\n",
+				name, kind, stats->calls,
+				Micros(stats->total).count(), Micros(stats->max).count(),
+				Micros(stats->convert).count(), Micros(stats->body).count(), Micros(stats->result).count());
+		}
+	}
+
+	int LuaLanguageModule::ExternalCall(lua_State* L, Address data) {
+		// L may be a coroutine of any context
+		ContextScope scope(*this, *GetContext(L), L);
+
+		const auto& plan = *data.As<const ExternalPlan*>();
+		const TimelineRecorder::Span span(_timeline.get(), TimelineRecorder::Category::Import, plan.method->GetName());
+
+		// Debug info is only looked up for calls that are recorded
+		[[maybe_unused]] const auto zone = _traceMode != TraceMode::Off && ShouldTrace() ? TraceCall(plan) : ScopedZone{};
+
+		const size_t paramCount = plan.params.size();
 		const auto size = static_cast<size_t>(lua_gettop(_L));
 		if (size < paramCount) {
-			ret.Set<int>(luaL_error(_L, "Wrong number of parameters, %zu when %zu required.", size, paramCount));
-			return;
+			return luaL_error(_L, "Wrong number of parameters, %zu when %zu required.", size, paramCount);
 		}
 
-		const size_t t = size - paramCount;
+		const int base = static_cast<int>(size - paramCount) + 1;
 
-		const auto& retType = method.GetRetType();
-		const bool hasHiddenParam = ValueUtils::IsHiddenParam(retType.GetType());
-		int refParamsCount = 0;
+		const bool timed = _statsEnabled;
+		const auto start = timed ? CallStats::Clock::now() : CallStats::Clock::time_point{};
 
-		ArgsScope a(hasHiddenParam + paramCount);
+		ArgsScope a(plan, _callArena);
 		Return r;
+		FlagScope marshalling(_marshalling, true);
 
-		if (hasHiddenParam) {
-			BeginExternalCall(retType.GetType(), a);
+		if (plan.begin) {
+			(this->*plan.begin)(a);
 		}
 
 		for (size_t i = 0; i < paramCount; ++i) {
-			const Property& paramType = paramTypes[i];
-			if (paramType.IsRef()) {
-				++refParamsCount;
-			}
-			using PushParamFunc = decltype(&LuaLanguageModule::PushObjectAsParam);
-			PushParamFunc const pushParamFunc = paramType.IsRef() ? &LuaLanguageModule::PushObjectAsRefParam : &LuaLanguageModule::PushObjectAsParam;
-			const bool pushResult = (this->*pushParamFunc)(paramType, static_cast<int>(i + 1 + t), a);
-			if (!pushResult) {
-				// pushParamFunc sets error
-				ret.Set<int>(static_cast<int>(i + 1));
-				return;
+			const auto& [push, paramType] = plan.params[i];
+			if (!(this->*push)(*paramType, base + static_cast<int>(i), a)) {
+				// push sets error
+				return static_cast<int>(i + 1);
 			}
 		}
 
-		bool result = MakeExternalCallWithObject(retType, data.As<JitCall::CallingFunc>(), a, r); // TODO: not push nil when void and no param
+		const auto converted = timed ? CallStats::Clock::now() : start;
+		_marshalling = false; // Native code may call back into Lua
+		plan.func(a.params.Get(), &r);
+		_marshalling = true;
+		const auto called = timed ? CallStats::Clock::now() : start;
 
-		if (refParamsCount != 0) {
-			int k = 0;
+		const bool result = (this->*plan.ret)(*plan.retType, r); // TODO: not push nil when void and no param
 
-			for (size_t i = 0, j = hasHiddenParam; i < paramCount; ++i) {
-				const Property& paramType = paramTypes[i];
-				if (!paramType.IsRef()) {
-					continue;
-				}
-				StorageValueToObject(paramType, a, j++);
-				if (++k == refParamsCount) {
-					break;
-				}
-			}
+		for (const auto& [push, slot, index] : plan.refParams) {
+			(this->*push)(a, slot, base + static_cast<int>(index));
+		}
+
+		if (timed) {
+			plan.stats.Record(start, converted, called, CallStats::Clock::now());
 		}
 
-		ret.Set<int>(refParamsCount + result);
+		return static_cast<int>(plan.refParams.size()) + result;
+	}
+
+	void LuaLanguageModule::PushExternalFunction(const ExternalPlan& plan) {
+		lua_pushlightuserdata(_L, const_cast<ExternalPlan*>(&plan));
+		lua_pushcclosure(_L, &ExternalCallClosure, 1);
 	}
 
 #pragma endregion ExternalCall
 
-	void LuaLanguageModule::ResolveRequiredModule(std::string_view moduleName) {
+	void LuaLanguageModule::ResolveRequiredModule(lua_State* L, std::string_view moduleName) {
+		ContextScope scope(*this, *GetContext(L), L);
+
 		const auto* plugin = _provider->FindExtension(moduleName);
 		if (plugin && plugin->GetState() == ExtensionState::Loaded) {
-			TryCreateModule(*plugin, false);
+			TryCreateModule(*plugin);
 		} else {
 			luaL_requiref(_L, moduleName.data(), &LoadEmpty, 1);
 			lua_pop(_L, 1);
 		}
 	}
 
-	void LuaLanguageModule::CreateEnumObject(LuaEnumSet& enumSet, const Property& paramType) {
-		if (const auto prototype = paramType.GetPrototype()) {
-			CreateEnumObject(enumSet, *prototype);
+	LuaLanguageModule::ModuleExports& LuaLanguageModule::GetModuleExports(const Extension& plugin) {
+		auto& exports = _moduleExports[plugin.GetId()];
+		if (exports) {
+			return *exports;
 		}
 
-		const auto enumerator = paramType.GetEnumerate();
-		if (!enumerator) {
-			return;
+		exports = std::make_unique<ModuleExports>();
+		exports->plugin = &plugin;
+
+		// Later kinds shadow earlier ones on a name clash: functions, enums, classes
+		const auto& methods = plugin.GetMethodsData();
+		exports->methods.reserve(methods.size());
+		for (size_t i = 0; i < methods.size(); ++i) {
+			const auto& method = methods[i].first;
+			exports->methods.emplace(method.GetName(), i);
+			CollectEnums(*exports, method.GetRetType());
+			for (const auto& paramType : method.GetParamTypes()) {
+				CollectEnums(*exports, paramType);
+			}
 		}
 
-		const auto& enumName = enumerator->GetName();
-		const auto& enumValues = enumerator->GetValues();
-		if (enumSet.contains(enumName) || enumValues.empty()) {
-			return;
+		const auto& classes = plugin.GetClasses();
+		exports->classes.reserve(classes.size());
+		for (const auto& cls : classes) {
+			exports->classes.emplace(cls.GetName(), &cls);
 		}
 
-		lua_newtable(_L);
+		return *exports;
+	}
 
-		for (const auto& enumValue : enumValues) {
-			lua_pushinteger(_L, enumValue.GetValue());
-			lua_setfield(_L, -2, enumValue.GetName().data());
+	void LuaLanguageModule::CollectEnums(ModuleExports& exports, const Property& paramType) {
+		if (const auto& prototype = paramType.GetPrototype()) {
+			CollectEnums(exports, prototype->GetRetType());
+			for (const auto& prototypeParam : prototype->GetParamTypes()) {
+				CollectEnums(exports, prototypeParam);
+			}
+		}
+
+		const auto& enumerator = paramType.GetEnumerate();
+		if (enumerator && !enumerator->GetValues().empty()) {
+			exports.enums.emplace(enumerator->GetName(), enumerator.get());
+		}
+	}
+
+	const LuaLanguageModule::ExternalPlan* LuaLanguageModule::GetModuleFunction(ModuleExports& exports, std::string_view name) {
+		if (const auto it = exports.functions.find(name); it != exports.functions.end()) {
+			return it->second;
+		}
+
+		const auto it = exports.methods.find(name);
+		if (it == exports.methods.end()) {
+			return nullptr;
+		}
+
+		const auto& [method, addr] = exports.plugin->GetMethodsData()[it->second];
+
+		JitCall call{};
+
+		const Address callAddr = call.GetJitFunc(method, addr);
+		if (!callAddr) {
+			_logger->Log(std::format(LOG_PREFIX "Lang module JIT failed to generate c++ call wrapper '{}'", call.GetError()), Severity::Fatal);
+			std::terminate();
 		}
 
-		lua_setfield(_L, -2, enumName.data());
+		auto plan = CreateExternalPlan(method, callAddr.As<JitCall::CallingFunc>());
+		const auto* const result = plan.get();
 
-		enumSet.emplace(enumName);
+		_moduleFunctions.emplace_back(std::move(call), std::move(plan));
+
+		exports.functions.emplace(method.GetName(), result);
+		return result;
 	}
 
-	void LuaLanguageModule::CreateEnumObject(LuaEnumSet& enumSet, const Method& method) {
-		CreateEnumObject(enumSet, method.GetRetType());
-		for (const auto& paramType : method.GetParamTypes()) {
-			CreateEnumObject(enumSet, paramType);
+	void LuaLanguageModule::PushEnumObject(const EnumObject& enumerator) {
+		const auto& enumValues = enumerator.GetValues();
+
+		lua_createtable(_L, 0, static_cast<int>(enumValues.size()));
+
+		for (const auto& enumValue : enumValues) {
+			lua_pushinteger(_L, enumValue.GetValue());
+			lua_setfield(_L, -2, enumValue.GetName().data());
 		}
 	}
 
@@ -2865,180 +2919,252 @@ namespace lualm {
 		}
 	}
 
-	bool LuaLanguageModule::PushAliasObject(const std::optional<Alias>& alias) {
-		if (!alias) {
-			lua_pushnil(_L);
-			return false;
+	const LuaLanguageModule::ExternalPlan& LuaLanguageModule::GetClassFunction(ModuleExports& exports, std::string_view name, std::string_view kind) {
+		const auto* plan = GetModuleFunction(exports, name);
+		if (!plan) {
+			_logger->Log(std::format(LOG_PREFIX "{} function not found: {}", kind, name), Severity::Fatal);
+			std::terminate();
 		}
+		return *plan;
+	}
 
-		lua_createtable(_L, 2, 0);
-
-		// [1] = name
-		PushLuaObject(alias->GetName());
-		lua_rawseti(_L, -2, 1);
+	const LuaLanguageModule::ClassPlan& LuaLanguageModule::GetClassPlan(ModuleExports& exports, const Class& cls) {
+		auto& plan = exports.classPlans[&cls];
+		if (plan) {
+			return *plan;
+		}
 
-		// [2] = owner
-		PushLuaObject(alias->IsOwner());
-		lua_rawseti(_L, -2, 2);
+		plan = std::make_unique<ClassPlan>();
+		plan->cls = &cls;
+		plan->plugin = exports.plugin;
 
-		return true;
-	}
+		const auto& constructors = cls.GetConstructors();
+		plan->constructors.reserve(constructors.size());
+		for (const auto& constructor : constructors) {
+			auto& overload = plan->constructors.emplace_back();
+			overload.function = &GetClassFunction(exports, constructor, "Constructor");
+			overload.params.reserve(overload.function->params.size());
+			for (const auto& [_, paramType] : overload.function->params) {
+				overload.params.push_back(GetAcceptedKinds(paramType->GetType()));
+			}
+		}
 
-	bool LuaLanguageModule::PushBindingObject(const LuaFunctionMap& functions, const Binding& binding) {
-		lua_createtable(_L, 5, 0);
+		if (const auto& destructor = cls.GetDestructor(); !destructor.empty()) {
+			plan->destructor = &GetClassFunction(exports, destructor, "Destructor");
+		}
 
-		// [1] = name
-		PushLuaObject(binding.GetName());
-		lua_rawseti(_L, -2, 1);
+		const auto& bindings = cls.GetBindings();
+		plan->bindings.reserve(bindings.size());
+		for (const auto& binding : bindings) {
+			auto& method = plan->bindings.emplace_back();
+			method.owner = plan.get();
+			method.function = &GetClassFunction(exports, binding.GetMethod(), "Method");
+			method.bindSelf = binding.IsBindSelf();
+
+			const auto& paramAliases = binding.GetParamAliases();
+			for (size_t i = 0; i < paramAliases.size(); ++i) {
+				if (const auto& alias = paramAliases[i]) {
+					method.handleParams.emplace_back(static_cast<int>(i), alias->IsOwner());
+				}
+			}
 
-		// [2] = func
-		auto it = functions.find(binding.GetMethod());
-		if (it != functions.end()) {
-			lua_pushcfunction(_L, it->second);
-		} else {
-			_logger->Log(std::format(LOG_PREFIX "Method function not found: {}", binding.GetMethod()), Severity::Fatal);
-			std::terminate();
+			if (const auto& retAlias = binding.GetRetAlias()) {
+				method.wrapReturn = true;
+				method.retOwner = retAlias->IsOwner();
+			}
 		}
-		lua_rawseti(_L, -2, 2);
 
-		// [3] = bindSelf
-		PushLuaObject(binding.IsBindSelf());
-		lua_rawseti(_L, -2, 3);
+		return *plan;
+	}
+
+	bool LuaLanguageModule::PushClassObject(ModuleExports& exports, const Class& cls) {
+		const auto& plan = GetClassPlan(exports, cls);
+		const auto& bindings = cls.GetBindings();
 
-		// [4] = paramAliases (array of Alias or nil)
-		const auto& paramAliases = binding.GetParamAliases();
-		lua_createtable(_L, static_cast<int>(paramAliases.size()), 0);
-		for (size_t j = 0; j < paramAliases.size(); ++j) {
-			PushAliasObject(paramAliases[j]);
-			lua_rawseti(_L, -2, static_cast<int>(j + 1));
+		lua_createtable(_L, 0, static_cast<int>(bindings.size()) + 11); // Stack: cls
+		const int clsIndex = lua_gettop(_L);
+		PushLuaObject(cls.GetName());
+		lua_setfield(_L, clsIndex, "__type");
+		lua_pushvalue(_L, clsIndex);
+		lua_setfield(_L, clsIndex, "__index");
+
+		PushInvalidValue(cls.GetHandleType(), cls.GetInvalidValue()); // Stack: cls, invalid
+		const int invalidIndex = lua_gettop(_L);
+		lua_pushvalue(_L, invalidIndex);
+		lua_setfield(_L, clsIndex, "__invalid"); // Read when another class returns this one
+
+		lua_pushlightuserdata(_L, const_cast<ClassPlan*>(&plan));
+		lua_pushvalue(_L, invalidIndex);
+		lua_pushvalue(_L, clsIndex);
+		lua_pushcclosure(_L, &NewClassClosure, 3);
+		lua_setfield(_L, clsIndex, "new");
+
+		lua_pushvalue(_L, clsIndex); // Stack: cls, invalid, cls
+		if (plan.destructor) {
+			PushExternalFunction(*plan.destructor);
+		} else {
+			lua_pushnil(_L);
 		}
-		lua_rawseti(_L, -2, 4);
+		lua_pushvalue(_L, invalidIndex);
+		luaL_setfuncs(_L, kClassFuncs, 2);
+		lua_pop(_L, 1);
 
-		// [5] = retAlias (Alias or nil)
-		PushAliasObject(binding.GetRetAlias());
-		lua_rawseti(_L, -2, 5);
+		// Bindings come last, so they may shadow the lifecycle methods
+		for (size_t i = 0; i < bindings.size(); ++i) {
+			lua_pushlightuserdata(_L, const_cast<BindingPlan*>(&plan.bindings[i]));
+			lua_pushvalue(_L, invalidIndex);
+			if (const auto& retAlias = bindings[i].GetRetAlias()) {
+				PushLuaObject(retAlias->GetName()); // Replaced by the class on first return
+			} else {
+				lua_pushnil(_L);
+			}
+			lua_pushcclosure(_L, &ClassMethodClosure, 3);
+			lua_setfield(_L, clsIndex, bindings[i].GetName().data());
+		}
 
+		lua_pop(_L, 1); // Pop invalid
 		return true;
 	}
 
-	void LuaLanguageModule::CreateClassObject(const LuaFunctionMap& functions, const Class& cls) {
-		const std::string& className = cls.GetName();
-
-		// Create class table
-		lua_newtable(_L);
-		PushLuaObject(className);
-		lua_setfield(_L, -2, "__type");
-		int cls_table_idx = lua_gettop(_L);
+	int LuaLanguageModule::NewClassObject(lua_State* L, Address data) {
+		const auto& plan = *data.As<const ClassPlan*>();
+		const int count = lua_gettop(L);
 
-		// Call bind_class_methods(cls, constructors, destructor, methods, invalid_value)
-		lua_rawgeti(_L, LUA_REGISTRYINDEX, _bindClassFunc);
+		// ClassName.new(handle, Ownership.OWNED/BORROWED) wraps an existing handle
+		if (count == 2 && IsOwnership(L, 2)) {
+			lua_rawgeti(L, LUA_REGISTRYINDEX, GetContext(L)->ownedRef);
+			PushClassHandle(L, 1, lua_upvalueindex(3), lua_rawequal(L, 2, -1));
+			return 1;
+		}
 
-		// Arg 1: cls (the class table)
-		lua_pushvalue(_L, cls_table_idx);
+		// ClassName.new(handle) owns the handle when there is no constructor to call
+		if (count == 1 && plan.constructors.empty()) {
+			PushClassHandle(L, 1, lua_upvalueindex(3), true);
+			return 1;
+		}
 
-		// Arg 2: constructors (array of functions)
-		const auto& constructors = cls.GetConstructors();
-		lua_createtable(_L, static_cast<int>(constructors.size()), 0);
-		for (size_t i = 0; i < constructors.size(); ++i) {
-			auto it = functions.find(constructors[i]);
-			if (it != functions.end()) {
-				lua_pushcfunction(_L, it->second);
-				lua_rawseti(_L, -2, static_cast<int>(i + 1));
-			} else {
-				_logger->Log(std::format(LOG_PREFIX "Constructor function not found: {}", constructors[i]), Severity::Fatal);
-				std::terminate();
-			}
+		const char* className = plan.cls->GetName().data();
+		if (plan.constructors.empty()) {
+			return luaL_error(L, "%s has no constructors. Use: %s(handle, Ownership.OWNED/BORROWED) or %s(handle) to wrap an existing handle.", className, className, className);
 		}
 
-		// Arg 3: destructor (function or nil)
-		const std::string& destructor = cls.GetDestructor();
-		if (!destructor.empty()) {
-			auto it = functions.find(destructor);
-			if (it != functions.end()) {
-				lua_pushcfunction(_L, it->second);
-			} else {
-				_logger->Log(std::format(LOG_PREFIX "Destructor function not found: {}", destructor), Severity::Fatal);
-				std::terminate();
+		// First overload whose parameters all accept the argument types, checked
+		// without calling anything
+		for (const auto& [function, params] : plan.constructors) {
+			if (params.size() != static_cast<size_t>(count)) {
+				continue;
+			}
+			int arg = 1;
+			while (arg <= count && (params[static_cast<size_t>(arg - 1)] & GetArgKind(L, arg))) {
+				++arg;
+			}
+			if (arg > count) {
+				ExternalCall(L, function);
+				PushClassHandle(L, count + 1, lua_upvalueindex(3), true);
+				return 1;
 			}
-		} else {
-			lua_pushnil(_L);
 		}
 
-		// Arg 4: methods (array of {name, func, bindSelf, paramAliases, retAlias})
-		const auto& bindings = cls.GetBindings();
-		lua_createtable(_L, static_cast<int>(bindings.size()), 0);
-		for (size_t i = 0; i < bindings.size(); ++i) {
-			PushBindingObject(functions, bindings[i]);
-			lua_rawseti(_L, -2, static_cast<int>(i + 1));
+		// Nothing matched, only now is the message put together
+		lua_pushfstring(L, "No constructor matched the arguments for %s(", className);
+		for (int arg = 1; arg <= count; ++arg) {
+			lua_pushstring(L, arg != 1 ? ", " : "");
+			PushKindNames(L, GetArgKind(L, arg));
 		}
-
-		// Arg 5: invalid_value
-		PushInvalidValue(cls.GetHandleType(), cls.GetInvalidValue());
-
-		// Call: bind_class_methods(cls, constructors, destructor, methods, invalid_value)
-		if (lua_pcall(_L, 5, 1, 0) != LUA_OK) {
-			[[maybe_unused]] auto _ = LogError(className, "bind_class_methods");
-			lua_pop(_L, 2); // Pop error and class table
-			return;
+		lua_pushliteral(L, ").\nCandidates:");
+		lua_concat(L, 2 * count + 2);
+		for (const auto& [function, params] : plan.constructors) {
+			lua_pushfstring(L, "\n\t%s(", function->method->GetName().data());
+			for (size_t i = 0; i < params.size(); ++i) {
+				lua_pushstring(L, i != 0 ? ", " : "");
+				PushKindNames(L, params[i]);
+			}
+			lua_pushliteral(L, ")");
+			lua_concat(L, 2 * static_cast<int>(params.size()) + 2); // Stack: message, candidates...
 		}
-
-		// Stack: [module_table, cls_table, result]
-		// Remove cls_table and set result in module_table
-		lua_remove(_L, -2); // Stack: [module_table, result]
-		lua_setfield(_L, -2, className.data()); // module_table[className] = result
+		lua_concat(L, static_cast<int>(plan.constructors.size()) + 1);
+		return luaL_error(L, "%s", lua_tostring(L, -1));
 	}
 
-	LuaFunctionMap LuaLanguageModule::CreateFunctions(const Extension& plugin) {
-		const auto& methods = plugin.GetMethodsData();
-
-		LuaFunctionMap funcs;
-		funcs.reserve(methods.size());
-
-		for (const auto& [method, addr] : methods) {
-			JitCall call{};
+	int LuaLanguageModule::CallClassMethod(lua_State* L, Address data) {
+		const auto& plan = *data.As<const BindingPlan*>();
 
-			const Address callAddr = call.GetJitFunc(method, addr);
-			if (!callAddr) {
-				_logger->Log(std::format(LOG_PREFIX "Lang module JIT failed to generate c++ call wrapper '{}'", call.GetError()), Severity::Fatal);
-				std::terminate();
+		// Stack: self, args... or args... for static methods
+		int first = 1;
+		if (plan.bindSelf) {
+			luaL_checktype(L, 1, LUA_TTABLE);
+			lua_getfield(L, 1, "_handle");
+			if (!lua_toboolean(L, -1) || lua_rawequal(L, -1, lua_upvalueindex(2))) {
+				return luaL_error(L, "%s handle is closed or not initialized", plan.owner->cls->GetName().data());
 			}
+			lua_replace(L, 1); // Stack: handle, args...
+			first = 2;
+		}
 
-			JitCallback callback{};
+		// Objects passed where a handle is expected give it up, or lend it
+		for (const auto& [index, owner] : plan.handleParams) {
+			const int arg = first + index;
+			if (lua_type(L, arg) != LUA_TTABLE) {
+				continue;
+			}
+			if (lua_getfield(L, arg, owner ? "release" : "get") != LUA_TFUNCTION) {
+				lua_pop(L, 1);
+				continue;
+			}
+			lua_pushvalue(L, arg);
+			lua_call(L, 1, 1);
+			lua_replace(L, arg);
+		}
 
-			Signature sig{};
-			sig.AddArg(ValueType::Pointer);
-			sig.SetRet(ValueType::Int32);
+		const int count = ExternalCall(L, plan.function);
+		if (!plan.wrapReturn || count == 0) {
+			return count;
+		}
 
-			// Generate function --> int (MethodLuaCall*)(lua_State* L)
-			const Address methodAddr = callback.GetJitFunc(sig, &method, &detail::ExternalCall, callAddr, false);
-			if (!methodAddr) {
-				_logger->Log(std::format(LOG_PREFIX "Lang module JIT failed to generate c++ lua_CFunction wrapper '{}'", callback.GetError()), Severity::Fatal);
-				std::terminate();
+		// The return class may belong to a module not bound yet, so it is looked up
+		// by name on first use and then kept in place of the name
+		if (lua_type(L, lua_upvalueindex(3)) == LUA_TSTRING) {
+			const char* className = lua_tostring(L, lua_upvalueindex(3));
+			lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+			lua_getfield(L, -1, plan.owner->plugin->GetName().data()); // Stack: ..., loaded, module
+			if (lua_istable(L, -1)) {
+				lua_getfield(L, -1, className);
+			} else {
+				lua_pushnil(L);
+			}
+			if (!lua_istable(L, -1)) { // Stack: ..., loaded, module, class
+				lua_pop(L, 1);
+				lua_getglobal(L, className);
 			}
+			if (lua_istable(L, -1)) {
+				lua_copy(L, -1, lua_upvalueindex(3));
+			}
+			lua_pop(L, 3);
+		}
 
-			_moduleFunctions.emplace_back(std::move(callback), std::move(call));
-
-			funcs.emplace(method.GetName(), methodAddr.As<lua_CFunction>());
+		// Stack: ..., result, ref params...
+		const int result = lua_gettop(L) - count + 1;
+		const bool hasClass = lua_istable(L, lua_upvalueindex(3));
+		if (hasClass) {
+			lua_getfield(L, lua_upvalueindex(3), "__invalid");
+		} else {
+			lua_pushvalue(L, lua_upvalueindex(2));
 		}
+		const bool invalid = lua_rawequal(L, result, -1);
+		lua_pop(L, 1);
 
-		return funcs;
+		if (invalid) {
+			lua_pushnil(L);
+			lua_replace(L, result);
+		} else if (hasClass) {
+			PushClassHandle(L, result, lua_upvalueindex(3), plan.retOwner);
+			lua_replace(L, result);
+		}
+		return count;
 	}
 
-	lua_CFunction LuaLanguageModule::OpenModule(std::string filename) {
-		filename.reserve(sizeof(std::string)); // disable SSO
-
-		JitCallback callback{};
-
-		Signature sig{};
-		sig.AddArg(ValueType::Pointer);
-		sig.SetRet(ValueType::Int32);
-
-		// Generate function --> int (MethodLuaCall*)(lua_State* L)
-		const Address methodAddr = callback.GetJitFunc(sig, nullptr, &LoadFile, filename.c_str(), false);
-		if (methodAddr) {
-			_loadFunctions.emplace_back(std::move(callback), std::move(filename));
-		}
-		return methodAddr.As<lua_CFunction>();
+	int LuaLanguageModule::LoadScript(lua_State* L, const char* filename) const {
+		return _bytecodeCache ? _bytecodeCache->Load(L, filename) : luaL_loadfile(L, filename);
 	}
 
 	Result<InitData> LuaLanguageModule::Initialize(const Provider& provider, const Extension& module) {
@@ -3052,117 +3178,257 @@ namespace lualm {
 			return MakeError("Failed to get module directory path");
 		}
 
-		const fs::path libPath = moduleBasePath / "lib";
-		if (!fs::exists(libPath, ec) || !fs::is_directory(libPath, ec)) {
+		_libPath = moduleBasePath / "lib";
+		if (!fs::exists(_libPath, ec) || !fs::is_directory(_libPath, ec)) {
 			return MakeError("lib directory not exists");
 		}
 
-		_L = luaL_newstate();
+		_isolatedPlugins = GetEnvFlag("LUALM_ISOLATED_PLUGINS");
+		_softMemoryLimit = GetEnvSize("LUALM_MEMORY_SOFT_LIMIT");
+		_hardMemoryLimit = GetEnvSize("LUALM_MEMORY_HARD_LIMIT");
+		_memoryAccounting = GetEnvFlag("LUALM_MEMORY_ACCOUNTING") || _softMemoryLimit != 0 || _hardMemoryLimit != 0;
+		_gcBudget = std::chrono::microseconds(GetEnvSize("LUALM_GC_BUDGET_US"));
+		if (const char* mode = std::getenv("LUALM_GC_MODE")) {
+			const std::string_view value(mode);
+			_gcGenerational = value == "generational";
+			if (!_gcGenerational && value != "incremental") {
+				WarnEnv("LUALM_GC_MODE", value, "incremental or generational");
+			}
+		}
+		if (const char* mode = std::getenv("LUALM_TRACE")) {
+			const std::string_view value(mode);
+			if (value != "off" && value != "sampled" && value != "full") {
+				WarnEnv("LUALM_TRACE", value, "off, sampled or full");
+			}
+			const size_t rate = GetEnvSize("LUALM_TRACE_SAMPLE_RATE");
+			SetTraceMode(value == "full" ? TraceMode::Full : value == "sampled" ? TraceMode::Sampled : TraceMode::Off,
+						 rate != 0 ? static_cast<uint32_t>(std::min<size_t>(rate, UINT32_MAX)) : 100);
+		}
+		_statsEnabled = GetEnvFlag("LUALM_STATS");
+		if (std::getenv("LUALM_STATS_INTERVAL")) {
+			_statsInterval = std::chrono::seconds(GetEnvSize("LUALM_STATS_INTERVAL"));
+		}
+		_statsNextDump = std::chrono::steady_clock::now() + _statsInterval;
+		if (GetEnvFlag("LUALM_BYTECODE_CACHE", true)) {
+			_bytecodeCache = std::make_unique<BytecodeCache>(_provider->GetCacheDir() / "lua", module.GetVersionString());
+
+			// Plugins are loaded one by one later on, so compiling up front can
+			// overlap the work. Opt-in, since the scan covers every script in the
+			// extensions tree, not only those of Lua plugins.
+			if (GetEnvFlag("LUALM_PRECOMPILE")) {
+				size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+				if (std::getenv("LUALM_COMPILE_THREADS")) {
+					threads = GetEnvSize("LUALM_COMPILE_THREADS");
+				}
+				if (threads != 0) {
+					_bytecodeCache->Precompile(FindScripts(_provider->GetExtensionsDir()), threads);
+				}
+			}
+		}
+
+		auto context = CreateContext();
+		if (!context) {
+			return MakeError(std::move(context.error()));
+		}
+
+		_context = *context;
+		_L = _context->L;
+
+		if (GetEnvFlag("LUALM_ALLOC_PROFILE")) {
+			const size_t rate = GetEnvSize("LUALM_ALLOC_PROFILE_RATE");
+			StartAllocationProfiler(rate != 0 ? rate : 64 * 1024);
+		}
+		if (GetEnvFlag("LUALM_TIMELINE")) {
+			const size_t capacity = GetEnvSize("LUALM_TIMELINE_EVENTS");
+			StartTimeline(capacity != 0 ? capacity : 64 * 1024);
+		}
+		if (GetEnvFlag("LUALM_PROFILE")) {
+			const size_t interval = GetEnvSize("LUALM_PROFILE_INTERVAL_US");
+			StartSampling(std::chrono::microseconds(interval != 0 ? interval : 1000), 1000);
+		}
+
+		return InitData{{.hasUpdate = true}};
+	}
+
+	Result<LuaContext*> LuaLanguageModule::CreateContext() {
+		auto context = std::make_unique<LuaContext>();
+
+		context->allocator.SetTracking(_memoryAccounting);
+		lua_State* L = lua_newstate(&LuaAllocator::Alloc, &context->allocator);
+		if (!L) {
+			return MakeError("Failed to create Lua state");
+		}
+		lua_atpanic(L, &Panic);
+		// Threads created later inherit a copy of the main thread extra space
+		*static_cast<LuaContext**>(lua_getextraspace(L)) = context.get();
+		context->L = L;
+
+		ContextScope scope(*this, *context, L);
+
 		luaL_openlibs(_L);
 
-		for (const auto& entry : fs::directory_iterator(libPath)) {
+		luaL_requiref(_L, "plugify.vector", &OpenVectorLib, 0);
+		lua_pop(_L, 1);
+		luaL_requiref(_L, "plugify.buffer", &OpenBufferLib, 0);
+		lua_pop(_L, 1);
+
+		luaL_getmetatable(_L, VectorTraits<plg::vec2>::kName);
+		context->vector2Meta = lua_topointer(_L, -1);
+		context->vector2Ref = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Vector2 metatable
+		luaL_getmetatable(_L, VectorTraits<plg::vec3>::kName);
+		context->vector3Meta = lua_topointer(_L, -1);
+		context->vector3Ref = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Vector3 metatable
+		luaL_getmetatable(_L, VectorTraits<plg::vec4>::kName);
+		context->vector4Meta = lua_topointer(_L, -1);
+		context->vector4Ref = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Vector4 metatable
+		luaL_getmetatable(_L, VectorTraits<plg::mat4x4>::kName);
+		context->matrix4x4Meta = lua_topointer(_L, -1);
+		context->matrix4x4Ref = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Matrix4x4 metatable
+
+		for (const auto& entry : fs::directory_iterator(_libPath)) {
 			if (entry.is_regular_file() && entry.path().extension() == ".lua") {
 				const std::string& filename = plg::as_string(entry.path().stem());
-				luaL_requiref(_L, filename.c_str(), OpenModule(plg::as_string(entry.path())), 0);
+				RequireFile(_L, filename.c_str(), plg::as_string(entry.path()));
 				lua_pop(_L, 1);
 			}
 		}
 
+		// Runtime controls live on the plugify module table
+		lua_getfield(_L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+		if (lua_getfield(_L, -1, "plugify") == LUA_TTABLE) {
+			luaL_setfuncs(_L, kPlugifyFuncs, 0);
+		}
+		lua_pop(_L, 2);
+
+		// Entries are removed by release_callback, the functions are pinned by
+		// their callbacks until then anyway
+		lua_newtable(_L);
+		context->callbackCacheRef = luaL_ref(_L, LUA_REGISTRYINDEX);
+
 		// Save original require
 		lua_getglobal(_L, "require");
-		_originalRequireRef = luaL_ref(_L, LUA_REGISTRYINDEX);
+		context->originalRequireRef = luaL_ref(_L, LUA_REGISTRYINDEX);
 
 		// Register our custom require
 		lua_pushcfunction(_L, CustomRequire);
 		lua_setglobal(_L, "require");
 
+		// Route the Lua file searcher through the bytecode cache
+		lua_getglobal(_L, "package"); // Stack: package
+		lua_getfield(_L, -1, "searchers"); // Stack: package, searchers
+		lua_pushvalue(_L, -2);
+		lua_pushcclosure(_L, &SearchLuaFile, 1);
+		lua_rawseti(_L, -2, 2); // searchers[2] = SearchLuaFile
+		lua_pop(_L, 2);
+
 		lua_getglobal(_L, "package"); // Stack: package
 		lua_getfield(_L, -1, "loaded"); // Stack: package, loaded
 		lua_getfield(_L, -1, "plugify"); // Stack: package, loaded, plugify
 
-		lua_getfield(_L, -1, "bind_class_methods");
-		if (!lua_isfunction(_L, -1)) {
+		// Objects of bound classes carry one of the Ownership values
+		lua_getfield(_L, -1, "Ownership"); // Stack: package, loaded, plugify, Ownership
+		if (!lua_istable(_L, -1)) {
 			lua_pop(_L, 4);
-			return MakeError("bind_class_methods is not a function");
+			lua_close(L);
+			return MakeError("Ownership is not a table");
 		}
+		lua_getfield(_L, -1, "OWNED");
+		context->ownedRef = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Ownership.OWNED
+		lua_getfield(_L, -1, "BORROWED");
+		context->borrowedRef = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Ownership.BORROWED
 
-		// Stack: package, loaded, bind_class_methods
-		_bindClassFunc = luaL_ref(_L, LUA_REGISTRYINDEX); // Store bind_class_methods instance
+		lua_pop(_L, 4); // Pop Ownership, plugify, loaded, package
 
-		lua_getfield(_L, -1, "Vector2"); // Stack: package, loaded, plugify, Vector2
-		lua_getfield(_L, -1, "new"); // Stack: package, loaded, plugify, Vector2, Vector2.new
+		if (_allocProfiler) {
+			context->allocator.SetSampling(_allocProfiler->GetSampleRate(), &SampleAllocation, context.get());
+		}
 
-		// Stack: package, loaded, Vector2, vector2_instance
-		_vector2Ref = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Vector2 instance
-		lua_pop(_L, 1);
+		if (_sampler) {
+			context->sampler = _sampler.get();
+			lua_sethook(_L, &SampleHook, LUA_MASKCOUNT, _samplerInstructions);
+		}
 
-		lua_getfield(_L, -1, "Vector3"); // Stack: package, loaded, plugify, Vector3
-		lua_getfield(_L, -1, "new"); // Stack: package, loaded, plugify, Vector3, Vector3.new
+		if (_gcGenerational) {
+			lua_gc(_L, LUA_GCGEN, 0, 0);
+		} else if (_gcBudget.count() != 0) {
+			lua_gc(_L, LUA_GCINC, kPacedPause, 0, 0);
+		}
+		context->gcBaseline = GetHeapSize(_L);
 
-		// Stack: package, loaded, Vector3, vector3_instance
-		_vector3Ref = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Vector3 instance
-		lua_pop(_L, 1);
+		return _contexts.emplace_back(std::move(context)).get();
+	}
 
-		lua_getfield(_L, -1, "Vector4"); // Stack: package, loaded, plugify, Vector4
-		lua_getfield(_L, -1, "new"); // Stack: package, loaded, plugify, Vector4, Vector4.new
+	void LuaLanguageModule::DestroyContext(LuaContext& context) {
+		lua_State* L = context.L;
 
-		// Stack: package, loaded, Vector4, vector4_instance
-		_vector4Ref = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Vector2 instance
-		lua_pop(_L, 1);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, context.originalRequireRef);
+		lua_setglobal(L, "require");
 
-		lua_getfield(_L, -1, "Matrix4x4"); // Stack: package, loaded, plugify, Matrix4x4
-		lua_getfield(_L, -1, "new"); // Stack: package, loaded, plugify, Matrix4x4, Matrix4x4.new
+		luaL_unref(L, LUA_REGISTRYINDEX, context.originalRequireRef);
+		luaL_unref(L, LUA_REGISTRYINDEX, context.ownedRef);
+		luaL_unref(L, LUA_REGISTRYINDEX, context.borrowedRef);
+		luaL_unref(L, LUA_REGISTRYINDEX, context.callbackCacheRef);
+		luaL_unref(L, LUA_REGISTRYINDEX, context.vector2Ref);
+		luaL_unref(L, LUA_REGISTRYINDEX, context.vector3Ref);
+		luaL_unref(L, LUA_REGISTRYINDEX, context.vector4Ref);
+		luaL_unref(L, LUA_REGISTRYINDEX, context.matrix4x4Ref);
+		context.externalMap.clear();
 
-		// Stack: package, loaded, Matrix4x4, matrix4x4_instance
-		_matrix4x4Ref = luaL_ref(_L, LUA_REGISTRYINDEX); // Store Matrix4x4 instance
-		lua_pop(_L, 1);
+		lua_close(L);
+		context.L = nullptr;
+	}
 
-		lua_pop(_L, 3); // Pop plugify, loaded, package
+	void LuaLanguageModule::RemoveContext(LuaContext& context) {
+		DestroyContext(context);
+		std::erase_if(_contexts, [&](const auto& entry) { return entry.get() == &context; });
+	}
 
-		return InitData{{.hasUpdate = false}};
+	void LuaLanguageModule::CheckMemory(LuaContext& context) {
+		if (const auto* owner = context.allocator.TakeCollectRequest()) {
+			_logger->Log(std::format(LOG_PREFIX "'{}' crossed its soft memory limit ({} of {} bytes), running full collection", owner->name, owner->bytesInUse, owner->softLimit), Severity::Warning);
+			lua_gc(context.L, LUA_GCCOLLECT);
+		}
 	}
 
 	Result<void> LuaLanguageModule::Shutdown() {
-		lua_rawgeti(_L, LUA_REGISTRYINDEX, _originalRequireRef);
-		lua_setglobal(_L, "require");
-
-		luaL_unref(_L, LUA_REGISTRYINDEX, _originalRequireRef);
-		_originalRequireRef = LUA_NOREF;
-		luaL_unref(_L, LUA_REGISTRYINDEX, _bindClassFunc);
-		_bindClassFunc = LUA_NOREF;
-		luaL_unref(_L, LUA_REGISTRYINDEX, _vector2Ref);
-		_vector2Ref = LUA_NOREF;
-		luaL_unref(_L, LUA_REGISTRYINDEX, _vector3Ref);
-		_vector3Ref = LUA_NOREF;
-		luaL_unref(_L, LUA_REGISTRYINDEX, _vector4Ref);
-		_vector4Ref = LUA_NOREF;
-		luaL_unref(_L, LUA_REGISTRYINDEX, _matrix4x4Ref);
-		_matrix4x4Ref = LUA_NOREF;
+		StopSampling();
+		StopAllocationProfiler();
+		StopTimeline();
+		if (_statsEnabled) {
+			DumpStats();
+		}
 
 		for (const auto& [_, data] : _pluginsMap) {
-			const auto& [instance, update, start, end] = data;
-			luaL_unref(_L, LUA_REGISTRYINDEX, update);
-			luaL_unref(_L, LUA_REGISTRYINDEX, start);
-			luaL_unref(_L, LUA_REGISTRYINDEX, end);
+			const auto& [instance, update, start, end] = data.refs;
+			luaL_unref(data.context->L, LUA_REGISTRYINDEX, update);
+			luaL_unref(data.context->L, LUA_REGISTRYINDEX, start);
+			luaL_unref(data.context->L, LUA_REGISTRYINDEX, end);
 		}
 		_pluginsMap.clear();
-		_internalMap.clear();
-		_externalMap.clear();
 		_internalFunctions.clear();
+		_retiredFunctions.clear();
+		_staleFunctions.clear();
 		_externalFunctions.clear();
 
 		for (const auto& [_, data] : _luaMethods) {
-			const auto& [plugin, method] = *data;
-			luaL_unref(_L, LUA_REGISTRYINDEX, method);
-			luaL_unref(_L, LUA_REGISTRYINDEX, plugin);
+			const auto& [context, owner, function, plan, staleReported] = *data;
+			const auto& [plugin, method] = function;
+			luaL_unref(context->L, LUA_REGISTRYINDEX, method);
+			luaL_unref(context->L, LUA_REGISTRYINDEX, plugin);
 		}
 		_luaMethods.clear();
-		_moduleFunctions.clear();
-		_loadFunctions.clear();
 
-		lua_close(_L);
+		for (const auto& context : _contexts) {
+			DestroyContext(*context);
+		}
+		_contexts.clear();
+		_context = nullptr;
 		_L = nullptr;
 
+		_moduleExports.clear();
+		_moduleFunctions.clear();
+		_bytecodeCache.reset();
+
 		_logger.reset();
 		_profiler.reset();
 		_provider.reset();
@@ -3171,9 +3437,69 @@ namespace lualm {
 	}
 
 	Result<void> LuaLanguageModule::OnUpdate([[maybe_unused]] std::chrono::milliseconds dt) {
+		_retiredFunctions.clear();
+
+		for (auto& [_, data] : _pluginsMap) {
+			if (!data.reloadRequested) {
+				continue;
+			}
+			data.reloadRequested = false;
+			if (auto result = ReloadPlugin(data); !result) {
+				_logger->Log(std::format(LOG_PREFIX "Failed to reload '{}': {}", data.plugin->GetName(), result.error()), Severity::Error);
+			} else {
+				_logger->Log(std::format(LOG_PREFIX "Reloaded '{}'", data.plugin->GetName()), Severity::Info);
+			}
+		}
+
+		if (_statsEnabled && _statsInterval.count() != 0 && std::chrono::steady_clock::now() >= _statsNextDump) {
+			_statsNextDump = std::chrono::steady_clock::now() + _statsInterval;
+			DumpStats();
+		}
+
+		// One budget for all states, each gets an equal share of what is left
+		// when its turn comes, so time an idle state does not use goes to the rest
+		auto now = std::chrono::steady_clock::now();
+		const auto end = now + _gcBudget;
+		size_t remaining = _contexts.size();
+
+		for (const auto& context : _contexts) {
+			ContextScope scope(*this, *context, context->L, 0);
+			if (context->gcRequested) {
+				context->gcRequested = false;
+				context->gcCycle = false;
+				const TimelineRecorder::Span span(_timeline.get(), TimelineRecorder::Category::Gc, "gc collect");
+				lua_gc(_L, LUA_GCCOLLECT);
+				context->gcBaseline = GetHeapSize(_L);
+			} else if (IsPacedGc()) {
+				StepGarbage(*context, now + (end - now) / remaining);
+			}
+			--remaining;
+			now = std::chrono::steady_clock::now();
+		}
 		return {};
 	}
 
+	void LuaLanguageModule::StepGarbage(LuaContext& context, std::chrono::steady_clock::time_point deadline) {
+		if (!context.gcCycle) {
+			if (GetHeapSize(_L) * 100 < context.gcBaseline * kIdlePause) {
+				return;
+			}
+			context.gcCycle = true;
+		}
+
+		const TimelineRecorder::Span span(_timeline.get(), TimelineRecorder::Category::Gc, "gc step");
+
+		// Basic steps are small, so overshooting the deadline is bounded by one
+		// step. A state whose share is already spent waits for the next update.
+		while (std::chrono::steady_clock::now() < deadline) {
+			if (lua_gc(_L, LUA_GCSTEP, 0)) {
+				context.gcCycle = false;
+				context.gcBaseline = GetHeapSize(_L);
+				break;
+			}
+		}
+	}
+
 	Result<LoadData> LuaLanguageModule::OnPluginLoad(const Extension& plugin) {
 		const std::string_view entryPoint = plugin.GetEntry();
 		if (entryPoint.empty()) {
@@ -3208,18 +3534,114 @@ namespace lualm {
 		}
 		const std::string& fileName = plg::as_string(filePath.stem());
 
-		luaL_requiref(_L, fileName.c_str(), OpenModule(plg::as_string(filePath)), 0);
+		// An isolated state made for this plugin goes away again if loading fails
+		struct ContextGuard {
+			LuaLanguageModule& module;
+			LuaContext* context;
+			~ContextGuard() {
+				if (context) {
+					module.RemoveContext(*context);
+				}
+			}
+		} guard{ *this, nullptr };
+
+		LuaContext* context = _contexts.front().get();
+		if (_isolatedPlugins) {
+			auto isolated = CreateContext();
+			if (!isolated) {
+				return MakeError(std::move(isolated.error()));
+			}
+			context = *isolated;
+			guard.context = context;
+		}
+
+		// Everything the plugin allocates from here on is charged to it when
+		// accounting is on, the owner also names the plugin in profiles
+		const uint32_t owner = context->allocator.AddOwner(std::string(plugin.GetName()), _softMemoryLimit, _hardMemoryLimit);
+
+		ContextScope scope(*this, *context, context->L, owner);
+
+		// The top-level chunk may leave the plugin at its limit, the exports
+		// below are registered outside lua_pcall
+		LimitScope limits(context->allocator);
+
+		PluginData data{ &plugin, context, owner, {}, fileName, std::string(pluginClassName), plg::as_string(filePath), {}, false };
+
+		Result<PluginInstance> instance = CreatePluginInstance(plugin, data);
+		if (!instance) {
+			return MakeError(std::move(instance.error()));
+		}
+		data.refs = *instance;
+		const auto [pluginRef, pluginUpdate, pluginStart, pluginEnd] = data.refs;
+
+		// Stack: plugin
+		const auto& exportedMethods = plugin.GetMethods();
+		std::vector<std::string> exportErrors;
+		std::vector<std::pair<const Method&, LuaMethodData>> methodsHolders;
+
+		for (size_t i = 0; i < exportedMethods.size(); ++i) {
+			const auto& method = exportedMethods[i];
+			Result<LuaMethodData> generateResult = GenerateMethodExport(method, pluginRef);
+			if (!generateResult) {
+				exportErrors.emplace_back(std::format("{:>3}. {} {}", i + 1, method.GetName(), generateResult.error()));
+				if (constexpr size_t kMaxDisplay = 100; exportErrors.size() >= kMaxDisplay) {
+					exportErrors.emplace_back(std::format("... and {} more", exportedMethods.size() - kMaxDisplay));
+					break;
+				}
+				continue;
+			}
+			methodsHolders.emplace_back(method, std::move(*generateResult));
+		}
+
+		lua_pop(_L, 1); // Pop plugin
+
+		if (!exportErrors.empty()) {
+			return MakeError("Invalid methods:\n{}", plg::join(exportErrors, "\n"));
+		}
+
+		std::vector<MethodData> methods;
+		methods.reserve(methodsHolders.size());
+		data.exports.reserve(methodsHolders.size());
+
+		for (const auto& [method, methodData] : methodsHolders) {
+			const Address methodAddr = methodData.jitCallback.GetFunction();
+			methods.emplace_back(method, methodAddr);
+			data.exports.emplace_back(&method, methodData.luaCallback.get(), methodAddr);
+		}
+
+		const MethodTable table{ pluginUpdate != LUA_NOREF, pluginStart != LUA_NOREF, pluginEnd != LUA_NOREF, !exportedMethods.empty() };
+
+		const auto [it, result] = _pluginsMap.try_emplace(plugin.GetId(), std::move(data));
+		if (!result) {
+			return MakeError("Save plugin data to map unsuccessful");
+		}
+		guard.context = nullptr;
+
+		_luaMethods.reserve(methodsHolders.size());
+
+		for (auto& [method, methodData] : methodsHolders) {
+			AddToFunctionsMap(methodData.jitCallback.GetFunction(), methodData.luaCallback->function);
+			_luaMethods.emplace_back(std::move(methodData));
+		}
+		return LoadData{ std::move(methods), &it->second, table };
+	}
+
+	Result<LuaLanguageModule::PluginInstance> LuaLanguageModule::CreatePluginInstance(const Extension& plugin, const PluginData& data) {
+		// On reload the owner may be close to its hard limit already
+		LimitScope limits(data.context->allocator);
+
+		RequireFile(_L, data.moduleName.c_str(), data.filePath);
 		lua_pop(_L, 1);
 
 		lua_getglobal(_L, "package"); // Stack: package
 		lua_getfield(_L, -1, "loaded"); // Stack: package, loaded
-		lua_getfield(_L, -1, fileName.c_str()); // Stack: package, loaded, plugin
+		lua_getfield(_L, -1, data.moduleName.c_str()); // Stack: package, loaded, plugin
 		if (!lua_istable(_L, -1)) {
 			lua_pop(_L, 3); // Pop plugin, loaded, package
 			return MakeError("Failed to find table");
 		}
 
-		lua_getfield(_L, -1, pluginClassName.data()); // Stack: package, loaded, plugin, Plugin
+		lua_getfield(_L, -1, data.className.c_str()); // Stack: package, loaded, plugin, Plugin
 		if (!lua_istable(_L, -1)) {
 			lua_pop(_L, 4); // Pop Plugin, plugin, loaded, package
 			return MakeError("Failed to find plugin class");
@@ -3258,108 +3680,291 @@ namespace lualm {
 		PushLuaObject(_provider->GetDataDir()); // data_dir
 		PushLuaObject(_provider->GetLogsDir()); // logs_dir
 		PushLuaObject(_provider->GetCacheDir()); // cache_dir
-		if (lua_pcall(_L, 16, 1, 0) != LUA_OK) {
+		limits.Enforce(true);
+		const int status = lua_pcall(_L, 16, 1, 0);
+		limits.Enforce(false);
+		if (status != LUA_OK) {
 			std::string errorString = std::format("Failed to create plugin instance: {}", lua_tostring(_L, -1));
 			lua_pop(_L, 5); // Pop error, Plugin, plugin, loaded, package
 			return MakeError(std::move(errorString));
 		}
 
 		// Store references to plugin_start, plugin_end, plugin_update (if they exist)
-		int pluginStart = LUA_NOREF;
-		int pluginUpdate = LUA_NOREF;
-		int pluginEnd = LUA_NOREF;
+		PluginInstance refs{ LUA_NOREF, LUA_NOREF, LUA_NOREF, LUA_NOREF };
 
 		lua_getfield(_L, -1, "plugin_start"); // Stack: ..., instance, plugin_start or nil
 		if (!lua_isnil(_L, -1)) {
-			pluginStart = luaL_ref(_L, LUA_REGISTRYINDEX); // Store plugin_start
+			refs.start = luaL_ref(_L, LUA_REGISTRYINDEX); // Store plugin_start
 		} else {
 			lua_pop(_L, 1); // Pop nil
 		}
 		lua_getfield(_L, -1, "plugin_update"); // Stack: ..., instance, plugin_update or nil
 		if (!lua_isnil(_L, -1)) {
-			pluginUpdate = luaL_ref(_L, LUA_REGISTRYINDEX); // Store plugin_update
+			refs.update = luaL_ref(_L, LUA_REGISTRYINDEX); // Store plugin_update
 		} else {
 			lua_pop(_L, 1); // Pop nil
 		}
 		lua_getfield(_L, -1, "plugin_end"); // Stack: ..., instance, plugin_end or nil
 		if (!lua_isnil(_L, -1)) {
-			pluginEnd = luaL_ref(_L, LUA_REGISTRYINDEX); // Store plugin_end
+			refs.end = luaL_ref(_L, LUA_REGISTRYINDEX); // Store plugin_end
 		} else {
 			lua_pop(_L, 1); // Pop nil
 		}
 
 		// Stack: package, loaded, plugin, Plugin, instance
-		int pluginRef = luaL_ref(_L, LUA_REGISTRYINDEX); // Store instance
+		refs.instance = luaL_ref(_L, LUA_REGISTRYINDEX); // Store instance
 		lua_pop(_L, 1); // Pop Plugin
 
-		const auto& exportedMethods = plugin.GetMethods();
-		std::vector<std::string> exportErrors;
-		std::vector<std::pair<const Method&, LuaMethodData>> methodsHolders;
+		lua_insert(_L, -3); // Stack: plugin, package, loaded
+		lua_pop(_L, 2); // Pop loaded, package
+		return refs;
+	}
 
-		for (size_t i = 0; i < exportedMethods.size(); ++i) {
-			const auto& method = exportedMethods[i];
-			Result<LuaMethodData> generateResult = GenerateMethodExport(method, pluginRef);
-			if (!generateResult) {
-				exportErrors.emplace_back(std::format("{:>3}. {} {}", i + 1, method.GetName(), generateResult.error()));
-				if (constexpr size_t kMaxDisplay = 100; exportErrors.size() >= kMaxDisplay) {
-					exportErrors.emplace_back(std::format("... and {} more", exportedMethods.size() - kMaxDisplay));
-					break;
+	void LuaLanguageModule::ReleasePluginInstance(const PluginInstance& refs) {
+		luaL_unref(_L, LUA_REGISTRYINDEX, refs.instance);
+		luaL_unref(_L, LUA_REGISTRYINDEX, refs.update);
+		luaL_unref(_L, LUA_REGISTRYINDEX, refs.start);
+		luaL_unref(_L, LUA_REGISTRYINDEX, refs.end);
+	}
+
+	LuaNameMap<fs::path> LuaLanguageModule::UnloadPluginModules(const Extension& plugin, LuaContext& context, int saved) {
+		std::error_code ec;
+		const fs::path root = fs::absolute(plugin.GetLocation(), ec).lexically_normal();
+
+		LuaNameMap<fs::path> files;
+		lua_getfield(_L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE); // Stack: loaded
+		for (auto it = context.moduleFiles.begin(); it != context.moduleFiles.end();) {
+			const auto& [name, path] = *it;
+			const fs::path relative = path.lexically_relative(root);
+			if (relative.empty() || *relative.begin() == "..") {
+				++it;
+				continue;
+			}
+			lua_getfield(_L, -1, name.c_str());
+			lua_setfield(_L, saved, name.c_str()); // saved[name] = loaded[name]
+			lua_pushnil(_L);
+			lua_setfield(_L, -2, name.c_str()); // loaded[name] = nil, next require runs the file again
+			auto node = context.moduleFiles.extract(it++);
+			files.insert(std::move(node));
+		}
+		lua_pop(_L, 1);
+		return files;
+	}
+
+	void LuaLanguageModule::RestorePluginModules(const Extension& plugin, LuaContext& context, LuaNameMap<fs::path> files, int saved) {
+		// Drop whatever the failed load registered, then put the old modules back
+		lua_newtable(_L); // Nothing of the failed load is kept
+		UnloadPluginModules(plugin, context, lua_gettop(_L));
+		lua_pop(_L, 1);
+
+		lua_getfield(_L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE); // Stack: loaded
+		for (auto& [name, path] : files) {
+			lua_getfield(_L, saved, name.c_str());
+			lua_setfield(_L, -2, name.c_str()); // loaded[name] = saved[name]
+		}
+		lua_pop(_L, 1);
+		context.moduleFiles.merge(files);
+	}
+
+	void LuaLanguageModule::InvalidateCallbacks(LuaContext& context, const std::unordered_set<void*>& addresses) {
+		if (addresses.empty()) {
+			return;
+		}
+
+		// Forget them in the cache, so passing the same function again builds a fresh thunk
+		lua_rawgeti(_L, LUA_REGISTRYINDEX, context.callbackCacheRef); // Stack: cache
+		lua_pushnil(_L);
+		while (lua_next(_L, -2)) { // Stack: cache, function, entry
+			bool empty = true;
+			lua_pushnil(_L);
+			while (lua_next(_L, -2)) { // Stack: cache, function, entry, key, value
+				if (lua_type(_L, -2) == LUA_TLIGHTUSERDATA) {
+					if (addresses.contains(lua_touserdata(_L, -1))) {
+						lua_pushvalue(_L, -2);
+						lua_pushnil(_L);
+						lua_rawset(_L, -5); // entry[prototype] = nil
+					} else {
+						empty = false;
+					}
 				}
+				lua_pop(_L, 1);
+			}
+			lua_pop(_L, 1); // Pop entry
+			if (empty) {
+				lua_pushvalue(_L, -1);
+				lua_pushnil(_L);
+				lua_rawset(_L, -4); // cache[function] = nil
+			}
+		}
+		lua_pop(_L, 1);
+
+		// Native code may still hold the addresses, so the thunks stay until
+		// shutdown as no-ops. Everything they kept alive in Lua is released.
+		for (void* const address : addresses) {
+			const auto it = _internalFunctions.find(address);
+			if (it == _internalFunctions.end()) {
 				continue;
 			}
-			methodsHolders.emplace_back(method, std::move(*generateResult));
+			LuaCallback& callback = *it->second.luaCallback;
+			context.externalMap.erase(address);
+			luaL_unref(context.L, LUA_REGISTRYINDEX, callback.function.second);
+			callback.function = { LUA_NOREF, LUA_NOREF };
+			_staleFunctions.emplace_back(std::move(it->second));
+			_internalFunctions.erase(it);
 		}
+	}
 
-		lua_pop(_L, 3); // Pop plugin, loaded, package
+	Result<void> LuaLanguageModule::ReloadPlugin(PluginData& data) {
+		const Extension& plugin = *data.plugin;
+		LuaContext& context = *data.context;
 
-		if (!exportErrors.empty()) {
-			return MakeError("Invalid methods:\n{}", plg::join(exportErrors, "\n"));
+		ContextScope scope(*this, context, context.L, data.owner);
+
+		// Runs from OnUpdate outside lua_pcall, with the owner possibly at its
+		// hard limit. Only the plugin's own code runs with the limit enforced.
+		LimitScope limits(context.allocator);
+
+		// The old instance may hand any Lua value to the new one. It stays in this
+		// state, so nothing is serialized.
+		int stateRef = LUA_NOREF;
+		lua_rawgeti(_L, LUA_REGISTRYINDEX, data.refs.instance); // Stack: instance
+		if (lua_getfield(_L, -1, "plugin_save_state") != LUA_TNIL) { // Stack: instance, plugin_save_state
+			lua_pushvalue(_L, -2); // self
+			limits.Enforce(true);
+			const int status = lua_pcall(_L, 1, 1, 0);
+			limits.Enforce(false);
+			if (status != LUA_OK) {
+				auto error = LogError(plugin.GetName(), "plugin_save_state");
+				lua_pop(_L, 2); // Pop error and instance
+				return MakeError("kept running the old instance: {}", error);
+			}
+			stateRef = luaL_ref(_L, LUA_REGISTRYINDEX); // Stack: instance
+		} else {
+			lua_pop(_L, 1); // Pop nil
 		}
+		lua_pop(_L, 1); // Pop instance
 
-		const auto [it, result] = _pluginsMap.try_emplace(
-				plugin.GetId(),
-				pluginRef,
-				pluginUpdate,
-				pluginStart,
-				pluginEnd);
-		if (!result) {
-			return MakeError("Save plugin data to map unsuccessful");
+		// Callbacks handed out so far belong to the old instance
+		std::unordered_set<void*> oldCallbacks;
+		for (const auto& [address, callback] : _internalFunctions) {
+			if (callback.luaCallback->context == &context && callback.luaCallback->owner == data.owner) {
+				oldCallbacks.insert(address);
+			}
 		}
 
-		std::vector<MethodData> methods;
-		methods.reserve(methodsHolders.size());
-		_luaMethods.reserve(methodsHolders.size());
+		// The old instance keeps running until the new one is complete. Its
+		// modules are set aside, so require runs the files again.
+		lua_newtable(_L); // Stack: saved
+		const int saved = lua_gettop(_L);
+		LuaNameMap<fs::path> files = UnloadPluginModules(plugin, context, saved);
 
-		for (auto& [method, methodData] : methodsHolders) {
-			const Address methodAddr = methodData.jitCallback.GetFunction();
-			methods.emplace_back(method, methodAddr);
-			AddToFunctionsMap(methodAddr, *methodData.luaFunction);
-			_luaMethods.emplace_back(std::move(methodData));
+		Result<PluginInstance> instance = CreatePluginInstance(plugin, data);
+		if (!instance) {
+			RestorePluginModules(plugin, context, std::move(files), saved);
+			lua_settop(_L, saved - 1);
+			luaL_unref(_L, LUA_REGISTRYINDEX, stateRef);
+			return MakeError("kept running the old instance: {}", instance.error());
+		}
+
+		// Stack: saved, plugin
+		std::vector<LuaFunction> functions;
+		functions.reserve(data.exports.size());
+		std::vector<std::string> exportErrors;
+		for (const auto& [method, callback, address] : data.exports) {
+			Result<LuaFunction> function = ResolveMethodExport(*method, instance->instance);
+			if (!function) {
+				exportErrors.emplace_back(std::format("{} {}", method->GetName(), function.error()));
+				continue;
+			}
+			functions.push_back(*function);
+		}
+		lua_pop(_L, 1); // Pop plugin
+
+		// Exports keep their addresses for other plugins, so each one needs a
+		// function in the new code
+		if (!exportErrors.empty()) {
+			for (const auto& [_, methodRef] : functions) {
+				luaL_unref(_L, LUA_REGISTRYINDEX, methodRef);
+			}
+			ReleasePluginInstance(*instance);
+			RestorePluginModules(plugin, context, std::move(files), saved);
+			lua_pop(_L, 1); // Pop saved
+			luaL_unref(_L, LUA_REGISTRYINDEX, stateRef);
+			return MakeError("kept running the old instance, invalid methods:\n{}", plg::join(exportErrors, "\n"));
+		}
+		lua_pop(_L, 1); // Pop saved
+
+		// A failing plugin_end is already logged and does not stop the reload
+		limits.Enforce(true);
+		std::ignore = CallPluginMethod(plugin, data, data.refs.end, "plugin_end");
+		limits.Enforce(false);
+
+		InvalidateCallbacks(context, oldCallbacks);
+		for (size_t i = 0; i < data.exports.size(); ++i) {
+			const auto& [method, callback, address] = data.exports[i];
+			luaL_unref(_L, LUA_REGISTRYINDEX, callback->function.second);
+			callback->function = functions[i];
+			context.externalMap.insert_or_assign(address, functions[i]);
+		}
+		ReleasePluginInstance(data.refs);
+		data.refs = *instance;
+
+		// The old instance and its modules are unreachable now
+		lua_gc(_L, LUA_GCCOLLECT);
+		CheckMemory(context);
+
+		if (stateRef != LUA_NOREF) {
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, data.refs.instance); // Stack: instance
+			if (lua_getfield(_L, -1, "plugin_restore_state") != LUA_TNIL) { // Stack: instance, plugin_restore_state
+				lua_pushvalue(_L, -2); // self
+				lua_rawgeti(_L, LUA_REGISTRYINDEX, stateRef); // state
+				limits.Enforce(true);
+				const int status = lua_pcall(_L, 2, 0, 0);
+				limits.Enforce(false);
+				if (status != LUA_OK) {
+					LogError(plugin.GetName(), "plugin_restore_state");
+					lua_pop(_L, 1); // Pop error
+				}
+			} else {
+				lua_pop(_L, 1); // Pop nil
+			}
+			lua_pop(_L, 1); // Pop instance
+			luaL_unref(_L, LUA_REGISTRYINDEX, stateRef);
+		}
+
+		// The host keeps the load time flags, a plugin_update added by the new
+		// code is only called if the old code had one too
+		limits.Enforce(true);
+		auto result = CallPluginMethod(plugin, data, data.refs.start, "plugin_start");
+		CheckMemory(context);
+		return result;
+	}
+
+	bool LuaLanguageModule::RequestReload(std::string_view pluginName) {
+		const auto* plugin = _provider->FindExtension(pluginName);
+		if (!plugin) {
+			return false;
 		}
-		return LoadData{ std::move(methods), &it->second, { pluginUpdate != LUA_NOREF, pluginStart != LUA_NOREF, pluginEnd != LUA_NOREF, !exportedMethods.empty() }};
+		const auto it = _pluginsMap.find(plugin->GetId());
+		if (it == _pluginsMap.end()) {
+			return false; // Not a Lua plugin
+		}
+		it->second.reloadRequested = true;
+		return true;
 	}
 
 	void LuaLanguageModule::AddToFunctionsMap(void* funcAddr, LuaFunction funcObj) {
-		_externalMap.emplace(funcAddr, funcObj);
-		_internalMap.emplace(funcObj, funcAddr);
+		_context->externalMap.emplace(funcAddr, funcObj);
 	}
 
 	LuaFunction LuaLanguageModule::FindExternal(void* funcAddr) const {
-		const auto it = _externalMap.find(funcAddr);
-		if (it != _externalMap.end()) {
+		const auto it = _context->externalMap.find(funcAddr);
+		if (it != _context->externalMap.end()) {
 			return it->second;
 		}
 		return {LUA_NOREF, LUA_NOREF};
 	}
 
-	void* LuaLanguageModule::FindInternal(LuaFunction funcObj) const {
-		const auto it = _internalMap.find(funcObj);
-		if (it != _internalMap.end()) {
-			return it->second;
-		}
-		return nullptr;
-	}
-
 	LuaError LuaLanguageModule::FetchError() const {
 		LuaError error{};
 
@@ -3397,14 +4002,19 @@ namespace lualm {
 		return message;
 	}
 
-	Result<void> LuaLanguageModule::OnPluginStart(const Extension& plugin) {
-		const auto& [instance, update, start, end] = *plugin.GetUserData().As<PluginData*>();
-		if (start != LUA_NOREF) {
-			lua_rawgeti(_L, LUA_REGISTRYINDEX, instance); // Stack: instance
-			lua_rawgeti(_L, LUA_REGISTRYINDEX, start); // Stack: instance, plugin_start
+	Result<void> LuaLanguageModule::CallPluginMethod(const Extension& plugin, const PluginData& data, int method, std::string_view name) {
+		if (method != LUA_NOREF) {
+			ContextScope scope(*this, *data.context, data.context->L, data.owner);
+			const CollectorHold hold(*data.context, IsPacedGc());
+			const std::string label = _timeline ? std::format("{}::{}", plugin.GetName(), name) : std::string{};
+			const TimelineRecorder::Span span(_timeline.get(), TimelineRecorder::Category::Lifecycle, label);
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, data.refs.instance); // Stack: instance
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, method); // Stack: instance, method
 			lua_pushvalue(_L, -2); // self
-			if (lua_pcall(_L, 1, 0, 0) != LUA_OK) {
-				auto error = LogError(plugin.GetName(), "plugin_start");
+			const int status = lua_pcall(_L, 1, 0, 0);
+			CheckMemory(*data.context);
+			if (status != LUA_OK) {
+				auto error = LogError(plugin.GetName(), name);
 				lua_pop(_L, 2); // Pop error and instance
 				return MakeError(std::move(error));
 			}
@@ -3413,14 +4023,25 @@ namespace lualm {
 		return {};
 	}
 
+	Result<void> LuaLanguageModule::OnPluginStart(const Extension& plugin) {
+		const auto& data = *plugin.GetUserData().As<PluginData*>();
+		return CallPluginMethod(plugin, data, data.refs.start, "plugin_start");
+	}
+
 	Result<void> LuaLanguageModule::OnPluginUpdate(const Extension& plugin, std::chrono::milliseconds dt) {
-		const auto& [instance, update, start, end] = *plugin.GetUserData().As<PluginData*>();
-		if (update != LUA_NOREF) {
-			lua_rawgeti(_L, LUA_REGISTRYINDEX, instance); // Stack: instance
-			lua_rawgeti(_L, LUA_REGISTRYINDEX, update); // Stack: instance, plugin_update
+		const auto& data = *plugin.GetUserData().As<PluginData*>();
+		if (data.refs.update != LUA_NOREF) {
+			ContextScope scope(*this, *data.context, data.context->L, data.owner);
+			const CollectorHold hold(*data.context, IsPacedGc());
+			const std::string label = _timeline ? std::format("{}::plugin_update", plugin.GetName()) : std::string{};
+			const TimelineRecorder::Span span(_timeline.get(), TimelineRecorder::Category::Lifecycle, label);
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, data.refs.instance); // Stack: instance
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, data.refs.update); // Stack: instance, plugin_update
 			lua_pushvalue(_L, -2); // self
 			lua_pushnumber(_L, std::chrono::duration<float>(dt).count()); // dt
-			if (lua_pcall(_L, 2, 0, 0) != LUA_OK) {
+			const int status = lua_pcall(_L, 2, 0, 0);
+			CheckMemory(*data.context);
+			if (status != LUA_OK) {
 				auto error = LogError(plugin.GetName(), "plugin_update");
 				lua_pop(_L, 2); // Pop error and instance
 				return MakeError(std::move(error));
@@ -3431,95 +4052,75 @@ namespace lualm {
 	}
 
 	Result<void> LuaLanguageModule::OnPluginEnd(const Extension& plugin) {
-		const auto& [instance, update, start, end] = *plugin.GetUserData().As<PluginData*>();
-		if (end != LUA_NOREF) {
-			lua_rawgeti(_L, LUA_REGISTRYINDEX, instance); // Stack: instance
-			lua_rawgeti(_L, LUA_REGISTRYINDEX, end); // Stack: instance, plugin_end
-			lua_pushvalue(_L, -2); // self
-			if (lua_pcall(_L, 1, 0, 0) != LUA_OK) {
-				auto error = LogError(plugin.GetName(), "plugin_end");
-				lua_pop(_L, 2); // Pop error and instance
-				return MakeError(std::move(error));
-			}
-			lua_pop(_L, 1); // Pop instance
-		}
-		return {};
+		const auto& data = *plugin.GetUserData().As<PluginData*>();
+		return CallPluginMethod(plugin, data, data.refs.end, "plugin_end");
 	}
 
 	Result<void> LuaLanguageModule::OnMethodExport(const Extension& plugin) {
-		TryCreateModule(plugin, true);
+		for (const auto& context : _contexts) {
+			ContextScope scope(*this, *context, context->L, 0);
+			TryCreateModule(plugin);
+		}
 		return {};
 	}
 
-	void LuaLanguageModule::TryCreateModule(const Extension& plugin, bool empty) {
-		auto is_table_empty = [](lua_State *L, int index) {
-			// Ensure the item at the given index is a table
-			if (!lua_istable(L, index)) {
-				luaL_error(L, "Expected a table");
-				return 0; // Not a table
-			}
-
-			// Duplicate the table to avoid modifying the original
-			lua_pushvalue(L, index);
-
-			// Push nil as the initial key for lua_next
-			lua_pushnil(L);
-
-			// Try to get the first key-value pair
-			if (lua_next(L, -2) == 0) {
-				// No key-value pairs found, table is empty
-				lua_pop(L, 1); // Pop the table copy
-				return 1; // Empty
-			}
-
-			// A key-value pair was found, so the table is not empty
-			lua_pop(L, 3); // Pop the key, value, and table copy
-			return 0; // Not empty
-		};
-
+	void LuaLanguageModule::TryCreateModule(const Extension& plugin) {
 		const char* modname = plugin.GetName().data();
 
-		lua_getglobal(_L, modname);
-		if (!lua_isnil(_L, -1)) {
-			if (!empty || !is_table_empty(_L, -1)) {
-				lua_pop(_L, 1); // Pop the module table
-				return; // Module already loaded or not empty
+		// A module required before its plugin was loaded is an empty placeholder
+		// that callers may already hold, so it is bound in place
+		lua_getfield(_L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE); // Stack: loaded
+		if (lua_getfield(_L, -1, modname) == LUA_TTABLE) { // Stack: loaded, module
+			if (lua_getmetatable(_L, -1)) {
+				lua_pop(_L, 3); // Already bound
+				return;
 			}
+		} else {
+			lua_pop(_L, 1);
+			const auto& exports = GetModuleExports(plugin);
+			const size_t size = exports.methods.size() + exports.classes.size() + exports.enums.size();
+			lua_createtable(_L, 0, static_cast<int>(size)); // Stack: loaded, module
+			lua_pushvalue(_L, -1);
+			lua_setfield(_L, -3, modname); // loaded[modname] = module
 		}
-		lua_pop(_L, 1); // Clean up the stack
-
-		// load
-		luaL_requiref(_L, modname, &LoadEmpty, 0);
 
-		LuaFunctionMap funcs = CreateFunctions(plugin);
-		for (const auto& [name, func] : funcs) {
-			lua_pushcfunction(_L, func);
-			lua_setfield(_L, -2, name.data()); // module[func_name] = func
-		}
+		// Exports are materialized by __index on first access and then raw set
+		lua_createtable(_L, 0, 1); // Stack: loaded, module, metatable
+		lua_pushlightuserdata(_L, &GetModuleExports(plugin));
+		lua_pushcclosure(_L, &ModuleIndex, 1);
+		lua_setfield(_L, -2, "__index");
+		lua_setmetatable(_L, -2);
 
-		LuaEnumSet enums;
-		for (const auto& method : plugin.GetMethods()) {
-			CreateEnumObject(enums, method);
-		}
+		lua_pop(_L, 2);
+	}
 
-		for (const auto& cls : plugin.GetClasses()) {
-			CreateClassObject(funcs, cls);
-		}
+	int LuaLanguageModule::IndexModule(lua_State* L, void* data) {
+		ContextScope scope(*this, *GetContext(L), L);
 
-#if VERBOSE
-		// stack top: module table
-		lua_pushnil(_L); // first key
-		while (lua_next(_L, -2) != 0) {  // -2: table, -1: value, -2: key
-			const char* k = lua_tostring(_L, -2);
-			int t = lua_type(_L, -1);
+		auto& exports = *static_cast<ModuleExports*>(data);
 
-			_logger->Log(std::format(LOG_PREFIX "{}: {}", k, lua_typename(_L, t)), Severity::Debug);
+		// Stack: module, key
+		if (lua_type(_L, 2) != LUA_TSTRING) {
+			return 0;
+		}
+		const std::string_view name = lua_tostring(_L, 2);
 
-			lua_pop(_L, 1); // pop value, keep key for next
+		if (const auto it = exports.classes.find(name); it != exports.classes.end()) {
+			if (!PushClassObject(exports, *it->second)) {
+				return 0;
+			}
+		} else if (const auto it2 = exports.enums.find(name); it2 != exports.enums.end()) {
+			PushEnumObject(*it2->second);
+		} else if (const auto* plan = GetModuleFunction(exports, name)) {
+			PushExternalFunction(*plan);
+		} else {
+			return 0;
 		}
-#endif
 
-		lua_pop(_L, 1);
+		lua_pushvalue(_L, 2);
+		lua_pushvalue(_L, -2);
+		lua_rawset(_L, 1); // module[name] = value, skips __index from now on
+		return 1;
 	}
 
 	bool LuaLanguageModule::IsDebugBuild() const noexcept {
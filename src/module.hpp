@@ -21,7 +21,19 @@
 #include <lauxlib.h>
 #include <lualib.h>
 
+#include "allocator.hpp"
+#include "arena.hpp"
+#include "cache.hpp"
+#include "sampler.hpp"
+#include "timeline.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <map>
+#include <memory>
+#include <new>
+#include <unordered_map>
 #include <unordered_set>
 #include <module_export.h>
 
@@ -54,14 +66,38 @@ namespace lualm {
 	constexpr auto MaxLuaTypes = static_cast<size_t>(LuaAbstractType::Max);
 
 	using LuaFunction = std::pair<int, int>;
-	using LuaInternalMap = std::unordered_map<LuaFunction, void*, plg::pair_hash<int, int>>;
 	using LuaExternalMap = std::unordered_map<void*, LuaFunction>;
-	using LuaEnumSet = std::unordered_set<std::string, plg::string_hash, std::equal_to<>>;
-	using LuaFunctionMap = std::unordered_map<std::string, lua_CFunction>;
+	template<typename T>
+	using LuaNameMap = std::unordered_map<std::string, T, plg::string_hash, std::equal_to<>>;
+	using LuaFunctionMap = LuaNameMap<lua_CFunction>;
+
+	enum class TraceMode : uint8_t {
+		Off,
+		Sampled,
+		Full,
+	};
 
-	struct LuaMethodData {
-		JitCallback jitCallback;
-		std::unique_ptr<LuaFunction> luaFunction;
+	// Crossings of one function boundary, split by phase. Only updated while
+	// stats are enabled.
+	struct CallStats {
+		using Clock = std::chrono::steady_clock;
+
+		uint64_t calls{};
+		Clock::duration total{};
+		Clock::duration max{};
+		Clock::duration convert{}; // Arguments into the callee
+		Clock::duration body{}; // Native or Lua function itself
+		Clock::duration result{}; // Return value and ref params back
+
+		void Record(Clock::time_point start, Clock::time_point converted, Clock::time_point called, Clock::time_point end) {
+			const auto elapsed = end - start;
+			++calls;
+			total += elapsed;
+			max = std::max(max, elapsed);
+			convert += converted - start;
+			body += called - converted;
+			result += end - called;
+		}
 	};
 
 	struct LuaError {
@@ -69,6 +105,41 @@ namespace lualm {
 		std::string traceback;
 	};
 
+	// Everything bound to a single lua_State. All plugins share one context
+	// unless isolated plugins are enabled, in which case each gets its own.
+	struct LuaContext {
+		LuaAllocator allocator; // Must outlive L
+		lua_State* L{nullptr};
+		int ownedRef{LUA_REFNIL}; // plugify.Ownership.OWNED
+		int borrowedRef{LUA_REFNIL}; // plugify.Ownership.BORROWED
+		int originalRequireRef{LUA_REFNIL};
+		int callbackCacheRef{LUA_REFNIL}; // function -> { [1] = hand-outs, [prototype] = thunk }
+		LuaNameMap<std::filesystem::path> moduleFiles; // package.loaded name -> script, for reloads
+		std::vector<bool> bufferReturns; // By allocator owner, see plugify.set_buffer_returns
+		int vector2Ref{LUA_REFNIL};
+		int vector3Ref{LUA_REFNIL};
+		int vector4Ref{LUA_REFNIL};
+		int matrix4x4Ref{LUA_REFNIL};
+		// Metatable identities, pinned in the registry by the refs above
+		const void* vector2Meta{nullptr};
+		const void* vector3Meta{nullptr};
+		const void* vector4Meta{nullptr};
+		const void* matrix4x4Meta{nullptr};
+		LuaExternalMap externalMap;
+		SamplingProfiler* sampler{nullptr}; // Set while the Lua profiler runs
+		// Collector pacing driven from OnUpdate
+		size_t gcBaseline{}; // Heap size after the last paced cycle
+		bool gcCycle{false}; // A paced cycle is in progress
+		bool gcRequested{false}; // Full collection asked for by a script
+		uint32_t gcHolds{}; // Nested host entries holding the collector
+		bool gcHeld{false}; // The outermost hold stopped the collector
+	};
+
+	// The owning context is stored in the extra space of every thread of a state
+	inline LuaContext* GetContext(lua_State* L) {
+		return *static_cast<LuaContext**>(lua_getextraspace(L));
+	}
+
 	class LuaLanguageModule final : public ILanguageModule {
 	public:
 		LuaLanguageModule() = default;
@@ -91,10 +162,127 @@ namespace lualm {
 		const std::shared_ptr<IProfiler>& GetProfiler() const { return _profiler; }
 
 	private:
+		using ParamToObjectFunc = bool (LuaLanguageModule::*)(const Property& paramType, ParametersSpan& params, size_t index);
+		using SetRefParamFunc = bool (LuaLanguageModule::*)(int arg, ParametersSpan& params, size_t index);
+		using SetReturnFunc = bool (LuaLanguageModule::*)(int arg, const Property& retType, ReturnSlot& ret);
+		using SetFallbackReturnFunc = void (LuaLanguageModule::*)(ReturnSlot& ret);
+
+		// Marshalling steps of an InternalCall target, resolved once per method
+		struct InternalPlan {
+			struct Param {
+				ParamToObjectFunc push;
+				const Property* type;
+			};
+			struct RefParam {
+				SetRefParamFunc set;
+				size_t index;
+			};
+			const Method* method{};
+			std::vector<Param> params;
+			std::vector<RefParam> refParams;
+			SetReturnFunc ret{};
+			SetFallbackReturnFunc fallback{};
+			const Property* retType{};
+			size_t retSize{};
+			int returnCount{};
+			mutable CallStats stats;
+		};
+
+		struct LuaCallback {
+			LuaContext* context;
+			uint32_t owner; // Allocator owner charged while the callback runs
+			LuaFunction function;
+			InternalPlan plan;
+			bool staleReported{}; // Called after its plugin was reloaded, logged once
+		};
+
+		// Makes a state current for the duration of an entry from the host
+		class ContextScope {
+		public:
+			ContextScope(LuaLanguageModule& module, LuaContext& context, lua_State* L, uint32_t owner)
+				: _module(module), _context(module._context), _L(module._L)
+				, _allocator(context.allocator), _owner(context.allocator.SetOwner(owner)) {
+				module._context = &context;
+				module._L = L;
+			}
+			// Keeps charging whoever owns the state right now
+			ContextScope(LuaLanguageModule& module, LuaContext& context, lua_State* L)
+				: ContextScope(module, context, L, context.allocator.GetOwner()) {
+			}
+			~ContextScope() {
+				_allocator.SetOwner(_owner);
+				_module._context = _context;
+				_module._L = _L;
+			}
+			ContextScope(const ContextScope&) = delete;
+			ContextScope& operator=(const ContextScope&) = delete;
+
+		private:
+			LuaLanguageModule& _module;
+			LuaContext* _context;
+			lua_State* _L;
+			LuaAllocator& _allocator;
+			uint32_t _owner;
+		};
+
+		struct PluginInstance {
+			int instance;
+			int update;
+			int start;
+			int end;
+		};
+		struct PluginExport {
+			const Method* method;
+			LuaCallback* callback;
+			void* address;
+		};
+		struct PluginData {
+			const Extension* plugin;
+			LuaContext* context;
+			uint32_t owner;
+			PluginInstance refs;
+			std::string moduleName; // Entry script, as a package.loaded key
+			std::string className;
+			std::string filePath;
+			std::vector<PluginExport> exports; // Rebound in place on reload
+			bool reloadRequested;
+		};
+
+		Result<LuaContext*> CreateContext();
+		void DestroyContext(LuaContext& context);
+		void RemoveContext(LuaContext& context);
+		void CheckMemory(LuaContext& context);
+
+		Result<PluginInstance> CreatePluginInstance(const Extension& plugin, const PluginData& data);
+		void ReleasePluginInstance(const PluginInstance& refs);
+		Result<void> CallPluginMethod(const Extension& plugin, const PluginData& data, int method, std::string_view name);
+		LuaNameMap<std::filesystem::path> UnloadPluginModules(const Extension& plugin, LuaContext& context, int saved);
+		void RestorePluginModules(const Extension& plugin, LuaContext& context, LuaNameMap<std::filesystem::path> files, int saved);
+		void InvalidateCallbacks(LuaContext& context, const std::unordered_set<void*>& addresses);
+		Result<void> ReloadPlugin(PluginData& data);
+		void StepGarbage(LuaContext& context, std::chrono::steady_clock::time_point deadline);
+		bool IsPacedGc() const { return _gcBudget.count() != 0 && !_gcGenerational; }
+
+		struct LuaMethodData {
+			JitCallback jitCallback;
+			std::unique_ptr<LuaCallback> luaCallback;
+		};
+
+		// Thunk of a Lua function handed to native code, built for one prototype.
+		// Native code may keep the address for as long as it likes, so the
+		// function is pinned by a registry ref. Nothing is reclaimed by the Lua
+		// collector: the thunks of a function are freed when
+		// plugify.release_callback drops its last hand-out, and turn into no-ops
+		// when the plugin that handed them out is reloaded.
+		struct CallbackData {
+			JitCallback jitCallback;
+			std::unique_ptr<LuaCallback> luaCallback;
+		};
+
+		Result<LuaFunction> ResolveMethodExport(const Method& method, int pluginRef);
 		Result<LuaMethodData> GenerateMethodExport(const Method& method, int pluginRef);
 		void AddToFunctionsMap(void* funcAddr, LuaFunction funcObj);
 		LuaFunction FindExternal(void* funcAddr) const;
-		void* FindInternal(LuaFunction funcObj) const;
 
 		template<typename T>
 		std::optional<T> ValueFromObject(int arg);
@@ -109,138 +297,269 @@ namespace lualm {
 		bool PushLuaObject(const T& value);
 		template<typename T>
 		bool PushLuaObjectList(const plg::vector<T>& arrayArg);
+		template<typename T>
+		bool PushVectorObject(const T& value, int metatableRef);
 		std::optional<void*> GetOrCreateFunctionValue(const Method& method, int arg);
+		void RetireCallback(void* funcAddr);
 		bool PushOrCreateFunctionObject(const Method& method, void* funcAddr);
 		template<typename T>
 		std::optional<T> GetObjectAttrAsValue(int absIndex, const char* attrName);
 		std::pair<LuaAbstractType, const char*> GetObjectType(int arg) const;
+		LuaAbstractType GetVectorType(int arg) const;
+		const float* GetVectorData(int arg, const void* metatable) const;
 
-		void SetFallbackReturn(ValueType retType, ReturnSlot& ret);
-		bool SetReturn(int arg, const Property& retType, ReturnSlot& ret);
-		bool SetRefParam(int arg, const Property& paramType, ParametersSpan& params, size_t index);
+		template<typename T>
+		std::optional<T> ObjectToValue(int arg);
+		template<typename T>
+		bool PushObject(const T& value);
+
+		template<typename T>
 		bool ParamToObject(const Property& paramType, ParametersSpan& params, size_t index);
+		template<typename T>
 		bool ParamRefToObject(const Property& paramType, ParametersSpan& params, size_t index);
+		bool ParamFunctionToObject(const Property& paramType, ParametersSpan& params, size_t index);
+		bool ParamUnsupportedToObject(const Property& paramType, ParametersSpan& params, size_t index);
+		template<typename T>
+		bool SetRefParam(int arg, ParametersSpan& params, size_t index);
+		template<typename T>
+		bool SetReturn(int arg, const Property& retType, ReturnSlot& ret);
+		bool SetVoidReturn(int arg, const Property& retType, ReturnSlot& ret);
+		bool SetFunctionReturn(int arg, const Property& retType, ReturnSlot& ret);
+		template<typename T>
+		void SetFallbackReturn(ReturnSlot& ret);
+		void SetVoidFallbackReturn(ReturnSlot& ret);
+		InternalPlan CreateInternalPlan(const Method& method) const;
+
+		struct ArgsScope;
+
+		using PushParamFunc = bool (LuaLanguageModule::*)(const Property& paramType, int arg, ArgsScope& a);
+		using PushStorageFunc = bool (LuaLanguageModule::*)(const ArgsScope& a, size_t slot, int arg);
+		using PushReturnFunc = bool (LuaLanguageModule::*)(const Property& retType, Return& ret);
+		using BeginReturnFunc = void (LuaLanguageModule::*)(ArgsScope& a);
+
+		// Marshalling steps of an ExternalCall target, resolved once per method
+		struct ExternalPlan {
+			struct Param {
+				PushParamFunc push;
+				const Property* type;
+			};
+			struct RefParam {
+				PushStorageFunc push;
+				size_t slot;
+				size_t index;
+			};
+			struct Slot {
+				size_t offset;
+				void (*destroy)(void* value);
+			};
+			const Method* method{};
+			std::string zoneName; // Profiler zone, built once per method
+			JitCall::CallingFunc func{};
+			BeginReturnFunc begin{};
+			PushReturnFunc ret{};
+			const Property* retType{};
+			std::vector<Param> params;
+			std::vector<RefParam> refParams;
+			std::vector<Slot> slots;
+			size_t frameSize{};
+			size_t frameAlign{alignof(std::max_align_t)};
+			bool hasHiddenParam{};
+			mutable CallStats stats;
+		};
 
+		// Per-call storage for values passed by pointer, laid out by the plan
+		// inside a CallArena frame. Slots are filled in order, and only those
+		// already constructed with a non-trivial destructor are destroyed.
 		struct ArgsScope {
-			using variant = plg::variant<
-				plg::invalid,
-
-				plg::none,
-				bool,
-				char,
-				char16_t,
-				int8_t,
-				int16_t,
-				int32_t,
-				int64_t,
-				uint8_t,
-				uint16_t,
-				uint32_t,
-				uint64_t,
-				void*,
-				float,
-				double,
-				plg::function,
-				plg::string,
-				plg::any,
-				plg::vector<bool>,
-				plg::vector<char>,
-				plg::vector<char16_t>,
-				plg::vector<int8_t>,
-				plg::vector<int16_t>,
-				plg::vector<int32_t>,
-				plg::vector<int64_t>,
-				plg::vector<uint8_t>,
-				plg::vector<uint16_t>,
-				plg::vector<uint32_t>,
-				plg::vector<uint64_t>,
-				plg::vector<void*>,
-				plg::vector<float>,
-				plg::vector<double>,
-				plg::vector<plg::string>,
-				plg::vector<plg::any>,
-				plg::vector<plg::vec2>,
-				plg::vector<plg::vec3>,
-				plg::vector<plg::vec4>,
-				plg::vector<plg::mat4x4>,
-				plg::vec2,
-				plg::vec3,
-				plg::vec4,
-				plg::mat4x4
-			>;
 			Parameters params;
-			std::inplace_vector<variant, Signature::kMaxFuncArgs + 1> storage;
+			const ExternalPlan& plan;
+			CallArena& arena;
+			CallArena::Mark mark;
+			std::byte* frame{};
+			size_t constructed{};
+
+			ArgsScope(const ExternalPlan& plan, CallArena& arena);
+			~ArgsScope();
+			ArgsScope(const ArgsScope&) = delete;
+			ArgsScope& operator=(const ArgsScope&) = delete;
+
+			template<typename T, typename... Args>
+			T* Emplace(Args&&... args) {
+				T* value = std::construct_at(reinterpret_cast<T*>(frame + plan.slots[constructed].offset), std::forward<Args>(args)...);
+				++constructed;
+				return value;
+			}
+
+			template<typename T>
+			T& Get(size_t slot) const {
+				return *std::launder(reinterpret_cast<T*>(frame + plan.slots[slot].offset));
+			}
+		};
+
+		template<typename T>
+		void BeginReturn(ArgsScope& a);
+		template<typename T>
+		bool PushValueParam(const Property& paramType, int arg, ArgsScope& a);
+		template<typename T>
+		bool PushStorageParam(const Property& paramType, int arg, ArgsScope& a);
+		bool PushStringParam(const Property& paramType, int arg, ArgsScope& a);
+		bool PushFunctionParam(const Property& paramType, int arg, ArgsScope& a);
+		bool PushUnsupportedParam(const Property& paramType, int arg, ArgsScope& a);
+		template<typename T>
+		bool PushStorageObject(const ArgsScope& a, size_t slot, int arg);
+		template<typename T>
+		bool PushReturnValue(const Property& retType, Return& ret);
+		template<typename T>
+		bool PushReturnPointer(const Property& retType, Return& ret);
+		bool PushReturnVoid(const Property& retType, Return& ret);
+		bool PushReturnFunction(const Property& retType, Return& ret);
+		bool PushReturnUnsupported(const Property& retType, Return& ret);
+		static PushParamFunc GetPushParamFunc(const Property& paramType);
+		static PushReturnFunc GetPushReturnFunc(const Property& retType);
+		std::unique_ptr<ExternalPlan> CreateExternalPlan(const Method& method, JitCall::CallingFunc func);
+		ScopedZone TraceCall(const ExternalPlan& plan) const;
+
+		struct StatsEntry {
+			std::string_view name;
+			const char* kind; // "import", "export" or "callback"
+			const CallStats* stats;
+		};
+		std::vector<StatsEntry> CollectStats() const;
+		void DumpStats() const;
+
+		// Off by default, sampled records one call in _traceSampleRate
+		bool ShouldTrace() {
+			if (_traceMode == TraceMode::Full) {
+				return true;
+			}
+			if (++_traceCounter < _traceSampleRate) {
+				return false;
+			}
+			_traceCounter = 0;
+			return true;
+		}
+
+		// Class method wrapper: handles are taken out of objects in place on the
+		// Lua stack and the result is wrapped into the return class
+		struct ClassPlan;
+		struct BindingPlan {
+			const ClassPlan* owner;
+			const ExternalPlan* function;
+			std::vector<std::pair<int, bool>> handleParams; // Argument after self, owner
+			bool bindSelf{};
+			bool wrapReturn{};
+			bool retOwner{};
+		};
+		// Constructor overload, matched by argument count and the Lua types
+		// each parameter accepts (ArgKind bits)
+		struct ConstructorPlan {
+			const ExternalPlan* function;
+			std::vector<uint16_t> params;
+		};
+		struct ClassPlan {
+			const Class* cls;
+			const Extension* plugin;
+			std::vector<ConstructorPlan> constructors;
+			const ExternalPlan* destructor{};
+			std::vector<BindingPlan> bindings;
+		};
 
-			explicit ArgsScope(size_t size);
+		// Exports of a plugin by name, turned into Lua values on first access.
+		// JIT wrappers are created once and shared by every state.
+		struct ModuleExports {
+			const Extension* plugin;
+			LuaNameMap<size_t> methods; // Index into GetMethodsData()
+			LuaNameMap<const Class*> classes;
+			LuaNameMap<const EnumObject*> enums;
+			LuaNameMap<const ExternalPlan*> functions; // Created so far
+			std::unordered_map<const Class*, std::unique_ptr<ClassPlan>> classPlans; // Bound so far
 		};
 
-		void BeginExternalCall(ValueType retType, ArgsScope& a) const;
-		bool MakeExternalCallWithObject(const Property& retType, JitCall::CallingFunc func, const ArgsScope& a, Return& ret);
-		bool PushObjectAsParam(const Property& paramType, int arg, ArgsScope& a);
-		bool PushObjectAsRefParam(const Property& paramType, int arg, ArgsScope& a);
-		bool StorageValueToObject(const Property& paramType, const ArgsScope& a, size_t index);
-		ScopedZone TraceCall(std::string_view methodName) const;
+		ModuleExports& GetModuleExports(const Extension& plugin);
+		void CollectEnums(ModuleExports& exports, const Property& paramType);
+		const ExternalPlan* GetModuleFunction(ModuleExports& exports, std::string_view name);
+		void PushExternalFunction(const ExternalPlan& plan);
 
 		bool PushInvalidValue(ValueType handleType, std::string_view invalidValue);
-		bool PushAliasObject(const std::optional<Alias>& alias);
-		bool PushBindingObject(const LuaFunctionMap& functions, const Binding& binding);
-		void CreateClassObject(const LuaFunctionMap& functions, const Class& cls);
-		void CreateEnumObject(LuaEnumSet& enumSet, const Property& paramType);
-		void CreateEnumObject(LuaEnumSet& enumSet, const Method& method);
+		const ExternalPlan& GetClassFunction(ModuleExports& exports, std::string_view name, std::string_view kind);
+		const ClassPlan& GetClassPlan(ModuleExports& exports, const Class& cls);
+		bool PushClassObject(ModuleExports& exports, const Class& cls);
+		void PushEnumObject(const EnumObject& enumerator);
 
 	public:
-		void TryCreateModule(const Extension& plugin, bool empty);
-		void ResolveRequiredModule(std::string_view moduleName);
-		LuaFunctionMap CreateFunctions(const Extension& plugin);
-		lua_CFunction OpenModule(std::string filename);
+		void TryCreateModule(const Extension& plugin);
+		void ResolveRequiredModule(lua_State* L, std::string_view moduleName);
+		bool RequestReload(std::string_view pluginName);
+		int IndexModule(lua_State* L, void* exports);
+		int CallClassMethod(lua_State* L, Address data);
+		int NewClassObject(lua_State* L, Address data);
+		int LoadScript(lua_State* L, const char* filename) const;
+		bool ReleaseCallback(lua_State* L, int arg);
 
 		LuaError FetchError() const;
 		void LogError() const;
 		std::string LogError(std::string_view name, std::string_view method) const;
 
+		void SetBufferReturns(lua_State* L, bool enable);
+		void SetStatsEnabled(bool enable) { _statsEnabled = enable; }
+		bool StartSampling(std::chrono::microseconds interval, int instructions);
+		std::optional<std::filesystem::path> StopSampling();
+		bool StartAllocationProfiler(size_t sampleRate);
+		std::optional<std::filesystem::path> StopAllocationProfiler();
+		void RecordAllocation(LuaContext& context, int kind, size_t size, size_t samples);
+		void ResolveAllocations(lua_State* L);
+		bool StartTimeline(size_t capacity);
+		std::optional<std::filesystem::path> FlushTimeline() const;
+		std::optional<std::filesystem::path> StopTimeline();
+		void PushStats(lua_State* L) const;
+		void SetTraceMode(TraceMode mode, uint32_t sampleRate) {
+			_traceMode = mode;
+			_traceSampleRate = std::max(sampleRate, 1u);
+			_traceCounter = 0;
+		}
+
 		void InternalCall(const Method& method, Address data, uint64_t* params, size_t count, void* ret);
-		void ExternalCall(const Method& method, Address data, uint64_t* params, size_t count, void* ret);
+		int ExternalCall(lua_State* L, Address data);
 
 	private:
 		std::unique_ptr<Provider> _provider;
 		std::shared_ptr<ILogger> _logger;
 		std::shared_ptr<IProfiler> _profiler;
-		lua_State* _L{nullptr};
-		int _bindClassFunc{LUA_REFNIL};
-		int _vector2Ref{LUA_REFNIL};
-		int _vector3Ref{LUA_REFNIL};
-		int _vector4Ref{LUA_REFNIL};
-		int _matrix4x4Ref{LUA_REFNIL};
-		struct PluginData {
-			int instance;
-			int update;
-			int start;
-			int end;
-		};
+		std::filesystem::path _libPath;
+		std::vector<std::unique_ptr<LuaContext>> _contexts; // front() is the shared state
+		LuaContext* _context{nullptr}; // Context currently executing
+		lua_State* _L{nullptr}; // Thread currently executing, belongs to _context
+		bool _isolatedPlugins{false};
+		bool _memoryAccounting{false};
+		size_t _softMemoryLimit{}; // Per plugin, 0 for none
+		size_t _hardMemoryLimit{}; // Per plugin, 0 for none
+		std::chrono::microseconds _gcBudget{}; // Per update, 0 leaves pacing to Lua
+		bool _gcGenerational{false};
+		std::unique_ptr<BytecodeCache> _bytecodeCache;
 		std::map<UniqueId, PluginData> _pluginsMap;
 		std::vector<LuaMethodData> _luaMethods;
+		CallArena _callArena;
+		TraceMode _traceMode{TraceMode::Off};
+		uint32_t _traceSampleRate{100};
+		uint32_t _traceCounter{};
+		bool _statsEnabled{false};
+		std::chrono::seconds _statsInterval{60}; // Between dumps to the logs directory, 0 for none
+		std::chrono::steady_clock::time_point _statsNextDump{};
+		std::unique_ptr<SamplingProfiler> _sampler; // Only while sampling
+		int _samplerInstructions{};
+		std::unique_ptr<AllocationProfiler> _allocProfiler; // Only while profiling
+		bool _marshalling{false}; // Converting values at the native boundary
+		std::unique_ptr<TimelineRecorder> _timeline; // Only while recording
 		struct JitHolder {
-			JitCallback jitCallback;
 			JitCall jitCall;
+			std::unique_ptr<ExternalPlan> plan;
 		};
 		std::vector<JitHolder> _moduleFunctions;
-		struct LoadHolder {
-			JitCallback jitCallback;
-			std::string filename;
-		};
-		std::vector<LoadHolder> _loadFunctions;
-		struct ExternalHolder {
-			JitCallback jitCallback;
-			JitCall jitCall;
-			std::unique_ptr<LuaFunction> luaFunction;
-		};
-		std::vector<ExternalHolder> _externalFunctions;
-		std::vector<LuaMethodData> _internalFunctions;
-		LuaExternalMap _externalMap;
-		LuaInternalMap _internalMap;
-
-	public:
-		int _originalRequireRef{LUA_REFNIL};
+		std::map<UniqueId, std::unique_ptr<ModuleExports>> _moduleExports;
+		std::unordered_map<void*, JitHolder> _externalFunctions; // By native function address
+		std::unordered_map<void*, CallbackData> _internalFunctions; // By thunk address
+		std::vector<CallbackData> _retiredFunctions; // Released, freed on the next update
+		std::vector<CallbackData> _staleFunctions; // Of reloaded plugins, native code may still call them
 	};
 }
 
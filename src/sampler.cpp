@@ -0,0 +1,149 @@
+#include "sampler.hpp"
+
+#include <plg/format.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+namespace lualm {
+	namespace {
+		// Lua passes internal types too for new objects, and 0 for plain blocks
+		const char* GetKindName(lua_State* L, int kind) {
+			if (kind < 0) {
+				return "resize";
+			}
+			if (kind > LUA_TNIL && kind < LUA_NUMTYPES) {
+				return lua_typename(L, kind);
+			}
+			switch (kind) {
+				case LUA_NUMTYPES:     return "upvalue";
+				case LUA_NUMTYPES + 1: return "proto";
+				default:               return "block";
+			}
+		}
+	}
+
+	void SamplingProfiler::Sample(lua_State* L, std::string_view root) {
+		// Levels count from the running function outwards, folded stacks go
+		// from the root inwards
+		int depth = 0;
+		lua_Debug ar;
+		while (lua_getstack(L, depth, &ar)) {
+			++depth;
+		}
+
+		_stack.assign(root);
+		for (int level = depth - 1; level >= 0; --level) {
+			lua_getstack(L, level, &ar);
+			_stack.push_back(';');
+			AppendFrame(L, ar);
+		}
+
+		++_stacks[_stack];
+		++_samples;
+	}
+
+	void SamplingProfiler::AppendFrame(lua_State* L, lua_Debug& ar) {
+		lua_getinfo(L, "Sn", &ar);
+
+		const size_t begin = _stack.size();
+		if (ar.what && ar.what[0] == 'C') {
+			std::format_to(std::back_inserter(_stack), "{} [C]", ar.name ? ar.name : "?");
+		} else {
+			std::format_to(std::back_inserter(_stack), "{} ({}:{})", ar.name ? ar.name : ar.what, ar.short_src, ar.linedefined);
+		}
+
+		// ';' separates frames and the count follows the last space
+		std::replace(_stack.begin() + static_cast<ptrdiff_t>(begin), _stack.end(), ';', ':');
+	}
+
+	bool SamplingProfiler::Write(const std::filesystem::path& path) const {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			return false;
+		}
+
+		std::vector<std::pair<std::string_view, uint64_t>> stacks(_stacks.begin(), _stacks.end());
+		std::ranges::sort(stacks);
+		for (const auto& [stack, count] : stacks) {
+			file << stack << ' ' << count << '\n';
+		}
+		return static_cast<bool>(file);
+	}
+
+	void AllocationProfiler::Record(lua_State* L, int kind, size_t size, size_t samples, bool marshalling) {
+		_pending.emplace_back(GetKindName(L, kind), size, samples, marshalling);
+		_samples += samples;
+	}
+
+	void AllocationProfiler::Resolve(lua_State* L) {
+		if (_pending.empty()) {
+			return;
+		}
+
+		// Skip native frames, the line that led to them is the useful part
+		std::string location = "[native]";
+		lua_Debug ar;
+		for (int level = 0; lua_getstack(L, level, &ar); ++level) {
+			lua_getinfo(L, "Sl", &ar);
+			if (ar.currentline > 0) {
+				location = std::format("{}:{}", ar.short_src, ar.currentline);
+				break;
+			}
+		}
+
+		for (const auto& pending : _pending) {
+			Charge(pending, location);
+		}
+		_pending.clear();
+	}
+
+	void AllocationProfiler::Charge(const Pending& pending, std::string_view location) {
+		_key.assign(pending.marshalling ? "marshalling\t" : "user\t");
+		_key.append(pending.type);
+		_key.push_back('\t');
+		_key.append(location);
+
+		auto& site = _sites[_key];
+		site.samples += pending.samples;
+		++site.allocations;
+		site.bytes += pending.size;
+	}
+
+	bool AllocationProfiler::Write(const std::filesystem::path& path) const {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			return false;
+		}
+
+		// Left over when profiling stopped before the next hook ran
+		std::unordered_map<std::string, Site> unresolved;
+		for (const auto& [type, size, samples, marshalling] : _pending) {
+			auto& site = unresolved[std::format("{}\t{}\t[unresolved]", marshalling ? "marshalling" : "user", type)];
+			site.samples += samples;
+			++site.allocations;
+			site.bytes += size;
+		}
+
+		std::vector<std::pair<std::string_view, const Site*>> sites;
+		sites.reserve(_sites.size() + unresolved.size());
+		for (const auto& [key, site] : _sites) {
+			sites.emplace_back(key, &site);
+		}
+		for (const auto& [key, site] : unresolved) {
+			sites.emplace_back(key, &site);
+		}
+		std::ranges::sort(sites, std::greater{}, [](const auto& entry) { return entry.second->samples; });
+
+		const double total = static_cast<double>(std::max<uint64_t>(_samples, 1));
+		file << std::format("# sample rate {} bytes, {} samples\n", _sampleRate, _samples);
+		file << std::format("{:>14} {:>7} {:>10} {:>12}\torigin\ttype\tlocation\n", "est. bytes", "share", "samples", "sampled");
+		for (const auto& [key, site] : sites) {
+			file << std::format("{:>14} {:>6.2f}% {:>10} {:>12}\t{}\n",
+				site->samples * _sampleRate, 100.0 * static_cast<double>(site->samples) / total,
+				site->samples, site->allocations, key);
+		}
+		return static_cast<bool>(file);
+	}
+}
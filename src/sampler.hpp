@@ -0,0 +1,96 @@
+#pragma once
+
+#include <lua.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace lualm {
+	// Statistical profiler for Lua code. A count hook calls Sample every few
+	// thousand instructions and a stack is recorded once per interval, so the
+	// sample counts approximate time. Stacks are kept in folded form, one
+	// "root;outer;...;inner count" line per distinct stack, which flame graph
+	// tools read directly.
+	class SamplingProfiler {
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		explicit SamplingProfiler(std::chrono::microseconds interval) : _interval(interval) {}
+
+		// Cheap enough to call from every hook invocation
+		bool Due() {
+			const auto now = Clock::now();
+			if (now - _lastSample < _interval) {
+				return false;
+			}
+			_lastSample = now;
+			return true;
+		}
+
+		// Records the stack of L below root, usually the running plugin
+		void Sample(lua_State* L, std::string_view root);
+
+		uint64_t GetSampleCount() const { return _samples; }
+		bool Write(const std::filesystem::path& path) const;
+
+	private:
+		void AppendFrame(lua_State* L, lua_Debug& ar);
+
+		std::chrono::microseconds _interval;
+		Clock::time_point _lastSample{};
+		std::unordered_map<std::string, uint64_t> _stacks;
+		std::string _stack; // Reused between samples
+		uint64_t _samples{};
+	};
+
+	// Allocation sampler fed by LuaAllocator sampling. Each sample is charged
+	// to the innermost Lua line on the stack and to the Lua type allocated, and
+	// split by whether it was made while the module converted values at the
+	// native boundary or while Lua code ran.
+	//
+	// The stack cannot be walked from inside the allocator, it may be halfway
+	// through a reallocation. Record only notes the sample, and Resolve charges
+	// the noted samples to the running line later, from a hook.
+	class AllocationProfiler {
+	public:
+		explicit AllocationProfiler(size_t sampleRate) : _sampleRate(sampleRate) {}
+
+		size_t GetSampleRate() const { return _sampleRate; }
+		uint64_t GetSampleCount() const { return _samples; }
+
+		// Safe inside the allocator, L is only used for type names
+		void Record(lua_State* L, int kind, size_t size, size_t samples, bool marshalling);
+		void Resolve(lua_State* L);
+
+		// Sites ranked by estimated bytes, largest first. Samples that were
+		// never resolved are listed as [unresolved].
+		bool Write(const std::filesystem::path& path) const;
+
+	private:
+		struct Site {
+			uint64_t samples;
+			uint64_t allocations;
+			uint64_t bytes; // Of the sampled allocations
+		};
+
+		struct Pending {
+			const char* type;
+			size_t size;
+			size_t samples;
+			bool marshalling;
+		};
+
+		void Charge(const Pending& pending, std::string_view location);
+
+		size_t _sampleRate;
+		std::vector<Pending> _pending; // Recorded, not resolved yet
+		std::unordered_map<std::string, Site> _sites; // "origin\ttype\tlocation"
+		std::string _key; // Reused between samples
+		uint64_t _samples{};
+	};
+}
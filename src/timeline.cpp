@@ -0,0 +1,122 @@
+#include "timeline.hpp"
+
+#include <plg/format.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace lualm {
+	namespace {
+		// Small stable ids read better in the viewer than hashed thread ids
+		uint32_t GetThreadIndex() {
+			static std::atomic<uint32_t> next{1};
+			thread_local const uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+			return index;
+		}
+
+		const char* GetCategoryName(TimelineRecorder::Category category) {
+			switch (category) {
+				case TimelineRecorder::Category::Import:    return "import";
+				case TimelineRecorder::Category::Export:    return "export";
+				case TimelineRecorder::Category::Lifecycle: return "lifecycle";
+				case TimelineRecorder::Category::Gc:        return "gc";
+			}
+			return "";
+		}
+
+		void WriteEscaped(std::ofstream& file, std::string_view str) {
+			for (const char c : str) {
+				switch (c) {
+					case '"':  file << "\\\""; break;
+					case '\\': file << "\\\\"; break;
+					default:
+						if (static_cast<unsigned char>(c) < 0x20) {
+							file << std::format("\\u{:04x}", static_cast<unsigned>(c));
+						} else {
+							file << c;
+						}
+				}
+			}
+		}
+	}
+
+	TimelineRecorder::TimelineRecorder(size_t capacity)
+		: _events(std::make_unique<Event[]>(std::bit_ceil(std::max<size_t>(capacity, 2))))
+		, _mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1) {
+	}
+
+	void TimelineRecorder::Add(Category category, std::string_view name, Clock::time_point begin, Clock::time_point end) {
+		const uint64_t index = _head.fetch_add(1, std::memory_order_relaxed);
+		Event& event = _events[index & _mask];
+
+		// Mark the slot as being written, Write skips it until it is published
+		event.sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		event.begin = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - _origin).count();
+		event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+		event.thread = GetThreadIndex();
+		event.category = category;
+
+		size_t size = std::min(name.size(), event.name.size());
+		if (size < name.size()) {
+			// Do not cut a UTF-8 sequence in half
+			while (size > 0 && (static_cast<unsigned char>(name[size]) & 0xC0) == 0x80) {
+				--size;
+			}
+		}
+		std::memcpy(event.name.data(), name.data(), size);
+		event.nameSize = static_cast<uint8_t>(size);
+
+		event.sequence.store(index + 1, std::memory_order_release);
+	}
+
+	bool TimelineRecorder::Write(const std::filesystem::path& path) const {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			return false;
+		}
+
+		const uint64_t head = _head.load(std::memory_order_acquire);
+		const uint64_t first = head > _mask + 1 ? head - (_mask + 1) : 0;
+
+		// Copy first, a slot is only valid when its sequence did not change meanwhile
+		std::vector<Event> events(static_cast<size_t>(head - first));
+		size_t count = 0;
+		for (uint64_t index = first; index < head; ++index) {
+			const Event& event = _events[index & _mask];
+			const uint64_t sequence = event.sequence.load(std::memory_order_acquire);
+			if (sequence != index + 1) {
+				continue;
+			}
+			Event& copy = events[count];
+			copy.begin = event.begin;
+			copy.duration = event.duration;
+			copy.thread = event.thread;
+			copy.category = event.category;
+			copy.nameSize = event.nameSize;
+			copy.name = event.name;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (event.sequence.load(std::memory_order_relaxed) == sequence) {
+				++count;
+			}
+		}
+
+		// Timestamps are in microseconds
+		file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		for (size_t i = 0; i < count; ++i) {
+			const Event& event = events[i];
+			file << (i != 0 ? ",\n" : "\n") << "{\"name\":\"";
+			WriteEscaped(file, std::string_view(event.name.data(), event.nameSize));
+			file << std::format("\",\"cat\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":1,\"tid\":{}}}",
+				GetCategoryName(event.category),
+				static_cast<double>(event.begin) / 1000.0, static_cast<double>(event.duration) / 1000.0,
+				event.thread);
+		}
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
+}
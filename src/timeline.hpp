@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+namespace lualm {
+	// Timeline of spans written as Chrome trace events, which chrome://tracing
+	// and Perfetto open directly. Spans go into a fixed ring buffer, so the
+	// newest events are kept when it wraps. Adding a span claims a slot with
+	// one atomic increment and takes no lock, so native threads calling into
+	// Lua can record too. Spans on one thread nest by time in the viewer.
+	class TimelineRecorder {
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		enum class Category : uint8_t {
+			Import, // Lua calling a native function
+			Export, // Native code calling a Lua function
+			Lifecycle, // plugin_start, plugin_update and plugin_end
+			Gc,
+		};
+
+		// Records from construction to destruction, does nothing without a recorder
+		class Span {
+		public:
+			Span(TimelineRecorder* recorder, Category category, std::string_view name)
+				: _recorder(recorder), _category(category), _name(name)
+				, _begin(recorder ? Clock::now() : Clock::time_point{}) {}
+			~Span() {
+				if (_recorder) {
+					_recorder->Add(_category, _name, _begin, Clock::now());
+				}
+			}
+			Span(const Span&) = delete;
+			Span& operator=(const Span&) = delete;
+
+		private:
+			TimelineRecorder* _recorder;
+			Category _category;
+			std::string_view _name;
+			Clock::time_point _begin;
+		};
+
+		// Capacity is rounded up to a power of two
+		explicit TimelineRecorder(size_t capacity);
+
+		void Add(Category category, std::string_view name, Clock::time_point begin, Clock::time_point end);
+
+		// Spans added so far, including those the ring has overwritten
+		uint64_t GetEventCount() const { return _head.load(std::memory_order_relaxed); }
+		size_t GetCapacity() const { return _mask + 1; }
+
+		// Writes the events still in the ring, recording may continue meanwhile
+		bool Write(const std::filesystem::path& path) const;
+
+	private:
+		struct Event {
+			std::atomic<uint64_t> sequence{}; // Index + 1 once written, 0 while empty
+			int64_t begin; // Nanoseconds since _origin
+			int64_t duration;
+			uint32_t thread;
+			Category category;
+			uint8_t nameSize;
+			std::array<char, 62> name; // Truncated, names are not owned by the plan
+		};
+
+		std::unique_ptr<Event[]> _events;
+		size_t _mask;
+		std::atomic<uint64_t> _head{};
+		Clock::time_point _origin{Clock::now()};
+	};
+}
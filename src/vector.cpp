@@ -0,0 +1,632 @@
+#include "vector.hpp"
+
+#include <cmath>
+#include <format>
+#include <functional>
+#include <string>
+
+namespace lualm {
+	namespace {
+		constexpr float kIdentity[16] = {
+			1, 0, 0, 0,
+			0, 1, 0, 0,
+			0, 0, 1, 0,
+			0, 0, 0, 1
+		};
+
+		template<typename T>
+		float* CheckVector(lua_State* L, int arg) {
+			return static_cast<float*>(luaL_checkudata(L, arg, VectorTraits<T>::kName));
+		}
+
+		template<typename T>
+		float* TestVector(lua_State* L, int arg) {
+			return static_cast<float*>(luaL_testudata(L, arg, VectorTraits<T>::kName));
+		}
+
+		template<typename T>
+		float* NewVector(lua_State* L) {
+			auto* data = static_cast<float*>(lua_newuserdatauv(L, sizeof(float) * VectorTraits<T>::kSize, 0));
+			luaL_setmetatable(L, VectorTraits<T>::kName);
+			return data;
+		}
+
+		template<typename T>
+		int ComponentIndex(lua_State* L, int arg) {
+			if (lua_type(L, arg) != LUA_TSTRING) {
+				return -1;
+			}
+			size_t length{};
+			const char* key = lua_tolstring(L, arg, &length);
+			if (length != 1) {
+				return -1;
+			}
+			int index;
+			switch (key[0]) {
+				case 'x': index = 0; break;
+				case 'y': index = 1; break;
+				case 'z': index = 2; break;
+				case 'w': index = 3; break;
+				default: return -1;
+			}
+			return index < VectorTraits<T>::kSize ? index : -1;
+		}
+
+		template<typename T>
+		lua_Number Dot(const float* a, const float* b) {
+			lua_Number sum = 0;
+			for (int i = 0; i < VectorTraits<T>::kSize; ++i) {
+				sum += static_cast<lua_Number>(a[i]) * static_cast<lua_Number>(b[i]);
+			}
+			return sum;
+		}
+
+		template<typename T>
+		int PushScaled(lua_State* L, const float* data, lua_Number scalar) {
+			float* result = NewVector<T>(L);
+			for (int i = 0; i < VectorTraits<T>::kSize; ++i) {
+				result[i] = static_cast<float>(data[i] * scalar);
+			}
+			return 1;
+		}
+
+		template<typename T>
+		int PushDivided(lua_State* L, const float* data, lua_Number scalar) {
+			float* result = NewVector<T>(L);
+			for (int i = 0; i < VectorTraits<T>::kSize; ++i) {
+				result[i] = static_cast<float>(data[i] / scalar);
+			}
+			return 1;
+		}
+
+		template<typename T, typename Op>
+		int VectorBinary(lua_State* L, Op op) {
+			const float* a = CheckVector<T>(L, 1);
+			const float* b = CheckVector<T>(L, 2);
+			float* result = NewVector<T>(L);
+			for (int i = 0; i < VectorTraits<T>::kSize; ++i) {
+				result[i] = op(a[i], b[i]);
+			}
+			return 1;
+		}
+
+		template<typename T>
+		int VectorNew(lua_State* L) {
+			constexpr int N = VectorTraits<T>::kSize;
+			float values[N];
+			for (int i = 0; i < N; ++i) {
+				values[i] = static_cast<float>(luaL_optnumber(L, i + 1, 0));
+			}
+			std::copy_n(values, N, NewVector<T>(L));
+			return 1;
+		}
+
+		template<typename T>
+		int VectorIndex(lua_State* L) {
+			const float* data = CheckVector<T>(L, 1);
+			if (const int index = ComponentIndex<T>(L, 2); index >= 0) {
+				lua_pushnumber(L, data[index]);
+				return 1;
+			}
+			lua_settop(L, 2);
+			lua_rawget(L, lua_upvalueindex(1)); // methods[key]
+			return 1;
+		}
+
+		template<typename T>
+		int VectorNewIndex(lua_State* L) {
+			float* data = CheckVector<T>(L, 1);
+			const int index = ComponentIndex<T>(L, 2);
+			if (index < 0) {
+				return luaL_error(L, "%s has no field '%s'", VectorTraits<T>::kName, luaL_tolstring(L, 2, nullptr));
+			}
+			data[index] = static_cast<float>(luaL_checknumber(L, 3));
+			return 0;
+		}
+
+		template<typename T>
+		int VectorAdd(lua_State* L) {
+			return VectorBinary<T>(L, std::plus<float>{});
+		}
+
+		template<typename T>
+		int VectorSub(lua_State* L) {
+			return VectorBinary<T>(L, std::minus<float>{});
+		}
+
+		template<typename T>
+		int VectorMul(lua_State* L) {
+			return PushScaled<T>(L, CheckVector<T>(L, 1), luaL_checknumber(L, 2));
+		}
+
+		template<typename T>
+		int VectorDiv(lua_State* L) {
+			return PushDivided<T>(L, CheckVector<T>(L, 1), luaL_checknumber(L, 2));
+		}
+
+		template<typename T>
+		int VectorDot(lua_State* L) {
+			lua_pushnumber(L, Dot<T>(CheckVector<T>(L, 1), CheckVector<T>(L, 2)));
+			return 1;
+		}
+
+		template<typename T>
+		int VectorMulOp(lua_State* L) {
+			if (lua_type(L, 1) == LUA_TNUMBER) {
+				return PushScaled<T>(L, CheckVector<T>(L, 2), lua_tonumber(L, 1));
+			}
+			if (lua_type(L, 2) == LUA_TNUMBER) {
+				return PushScaled<T>(L, CheckVector<T>(L, 1), lua_tonumber(L, 2));
+			}
+			return VectorDot<T>(L);
+		}
+
+		template<typename T>
+		int VectorDivOp(lua_State* L) {
+			if (lua_type(L, 2) != LUA_TNUMBER) {
+				return luaL_error(L, "Cannot divide vector by vector");
+			}
+			return PushDivided<T>(L, CheckVector<T>(L, 1), lua_tonumber(L, 2));
+		}
+
+		template<typename T>
+		int VectorUnm(lua_State* L) {
+			return PushScaled<T>(L, CheckVector<T>(L, 1), -1);
+		}
+
+		template<typename T>
+		int VectorLength(lua_State* L) {
+			const float* data = CheckVector<T>(L, 1);
+			lua_pushnumber(L, std::sqrt(Dot<T>(data, data)));
+			return 1;
+		}
+
+		template<typename T>
+		int VectorSqrLength(lua_State* L) {
+			const float* data = CheckVector<T>(L, 1);
+			lua_pushnumber(L, Dot<T>(data, data));
+			return 1;
+		}
+
+		template<typename T>
+		int VectorNormalized(lua_State* L) {
+			const float* data = CheckVector<T>(L, 1);
+			const lua_Number length = std::sqrt(Dot<T>(data, data));
+			if (length > 0) {
+				return PushDivided<T>(L, data, length);
+			}
+			return PushScaled<T>(L, data, 0);
+		}
+
+		template<typename T>
+		int VectorDistance(lua_State* L) {
+			const float* a = CheckVector<T>(L, 1);
+			const float* b = CheckVector<T>(L, 2);
+			lua_Number sum = 0;
+			for (int i = 0; i < VectorTraits<T>::kSize; ++i) {
+				const lua_Number d = static_cast<lua_Number>(a[i]) - static_cast<lua_Number>(b[i]);
+				sum += d * d;
+			}
+			lua_pushnumber(L, std::sqrt(sum));
+			return 1;
+		}
+
+		template<typename T>
+		int VectorLerp(lua_State* L) {
+			const float* a = CheckVector<T>(L, 1);
+			const float* b = CheckVector<T>(L, 2);
+			const lua_Number t = std::clamp<lua_Number>(luaL_checknumber(L, 3), 0, 1); // Clamp t between 0 and 1
+			float* result = NewVector<T>(L);
+			for (int i = 0; i < VectorTraits<T>::kSize; ++i) {
+				result[i] = static_cast<float>(a[i] + (b[i] - a[i]) * t);
+			}
+			return 1;
+		}
+
+		template<typename T>
+		int VectorEquals(lua_State* L) {
+			const float* a = CheckVector<T>(L, 1);
+			const float* b = TestVector<T>(L, 2);
+			lua_pushboolean(L, b && std::equal(a, a + VectorTraits<T>::kSize, b));
+			return 1;
+		}
+
+		template<typename T>
+		int VectorToString(lua_State* L) {
+			const float* data = CheckVector<T>(L, 1);
+			std::string str(VectorTraits<T>::kName);
+			str += '(';
+			for (int i = 0; i < VectorTraits<T>::kSize; ++i) {
+				std::format_to(std::back_inserter(str), "{}{:f}", i == 0 ? "" : ", ", data[i]);
+			}
+			str += ')';
+			lua_pushlstring(L, str.data(), str.size());
+			return 1;
+		}
+
+		int Vector3Cross(lua_State* L) {
+			const float* a = CheckVector<plg::vec3>(L, 1);
+			const float* b = CheckVector<plg::vec3>(L, 2);
+			float* result = NewVector<plg::vec3>(L);
+			result[0] = a[1] * b[2] - a[2] * b[1];
+			result[1] = a[2] * b[0] - a[0] * b[2];
+			result[2] = a[0] * b[1] - a[1] * b[0];
+			return 1;
+		}
+
+		// Views returned by matrix.m and matrix.m[i], they keep the matrix in
+		// their user value and write through to it
+		constexpr const char* kRowsName = "Matrix4x4.Rows";
+		constexpr const char* kRowName = "Matrix4x4.Row";
+
+		float* GetViewMatrix(lua_State* L, int arg) {
+			lua_getiuservalue(L, arg, 1);
+			float* data = CheckVector<plg::mat4x4>(L, -1);
+			lua_pop(L, 1); // Still referenced by the view
+			return data;
+		}
+
+		// 0-based index, or -1 when the key is not an integer in [1, 4]
+		int GetViewIndex(lua_State* L, int arg) {
+			int isInteger{};
+			const lua_Integer index = lua_tointegerx(L, arg, &isInteger);
+			return isInteger && index >= 1 && index <= 4 ? static_cast<int>(index - 1) : -1;
+		}
+
+		int ViewLength(lua_State* L) {
+			lua_pushinteger(L, 4);
+			return 1;
+		}
+
+		int MatrixRowsIndex(lua_State* L) {
+			luaL_checkudata(L, 1, kRowsName);
+			const int row = GetViewIndex(L, 2);
+			if (row < 0) {
+				lua_pushnil(L); // Ends ipairs
+				return 1;
+			}
+			*static_cast<int*>(lua_newuserdatauv(L, sizeof(int), 1)) = row;
+			lua_getiuservalue(L, 1, 1);
+			lua_setiuservalue(L, -2, 1);
+			luaL_setmetatable(L, kRowName);
+			return 1;
+		}
+
+		int MatrixRowsNewIndex(lua_State* L) {
+			return luaL_error(L, "Matrix4x4 rows cannot be replaced, assign elements with m[i][j] = value");
+		}
+
+		int MatrixRowIndex(lua_State* L) {
+			const int row = *static_cast<const int*>(luaL_checkudata(L, 1, kRowName));
+			const int col = GetViewIndex(L, 2);
+			if (col < 0) {
+				lua_pushnil(L);
+				return 1;
+			}
+			lua_pushnumber(L, GetViewMatrix(L, 1)[row * 4 + col]);
+			return 1;
+		}
+
+		int MatrixRowNewIndex(lua_State* L) {
+			const int row = *static_cast<const int*>(luaL_checkudata(L, 1, kRowName));
+			const int col = GetViewIndex(L, 2);
+			luaL_argcheck(L, col >= 0, 2, "index out of range [1, 4]");
+			GetViewMatrix(L, 1)[row * 4 + col] = static_cast<float>(luaL_checknumber(L, 3));
+			return 0;
+		}
+
+		int CheckMatrixIndex(lua_State* L, int arg) {
+			const lua_Integer index = luaL_checkinteger(L, arg);
+			luaL_argcheck(L, index >= 1 && index <= 4, arg, "index out of range [1, 4]");
+			return static_cast<int>(index - 1);
+		}
+
+		// 3x3 determinant of the matrix without the given row and column
+		lua_Number Minor3x3(const float* m, int row, int col) {
+			lua_Number minor[9];
+			int k = 0;
+			for (int i = 0; i < 4; ++i) {
+				if (i == row) {
+					continue;
+				}
+				for (int j = 0; j < 4; ++j) {
+					if (j != col) {
+						minor[k++] = m[i * 4 + j];
+					}
+				}
+			}
+			return minor[0] * (minor[4] * minor[8] - minor[5] * minor[7])
+				 - minor[1] * (minor[3] * minor[8] - minor[5] * minor[6])
+				 + minor[2] * (minor[3] * minor[7] - minor[4] * minor[6]);
+		}
+
+		lua_Number Determinant4x4(const float* m) {
+			lua_Number det = 0;
+			for (int j = 0; j < 4; ++j) {
+				det += (j % 2 == 0 ? 1 : -1) * m[j] * Minor3x3(m, 0, j);
+			}
+			return det;
+		}
+
+		// Constructor with multiple forms:
+		// 1. No args: identity matrix
+		// 2. 16 scalars: m11, m12, ..., m44
+		// 3. Nested table (4x4): {{m11,m12,m13,m14}, {m21,...}, ...}
+		// 4. Flat array (16 elements): {m11,m12,m13,m14, m21,...}
+		int MatrixNew(lua_State* L) {
+			float values[16];
+			std::copy_n(kIdentity, 16, values);
+
+			const int top = lua_gettop(L);
+			if (top == 16) {
+				for (int i = 0; i < 16; ++i) {
+					values[i] = static_cast<float>(luaL_checknumber(L, i + 1));
+				}
+			} else if (top == 1 && lua_istable(L, 1)) {
+				const lua_Unsigned length = lua_rawlen(L, 1);
+				if (length == 16) {
+					for (int i = 0; i < 16; ++i) {
+						lua_rawgeti(L, 1, i + 1);
+						values[i] = static_cast<float>(lua_tonumber(L, -1));
+						lua_pop(L, 1);
+					}
+				} else if (length == 4 && lua_rawgeti(L, 1, 1) == LUA_TTABLE) {
+					lua_pop(L, 1);
+					for (int i = 0; i < 4; ++i) {
+						if (lua_rawgeti(L, 1, i + 1) != LUA_TTABLE) {
+							return luaL_error(L, "Invalid table format for Matrix4x4 constructor");
+						}
+						for (int j = 0; j < 4; ++j) {
+							lua_rawgeti(L, -1, j + 1);
+							values[i * 4 + j] = static_cast<float>(lua_tonumber(L, -1)); // nil -> 0
+							lua_pop(L, 1);
+						}
+						lua_pop(L, 1);
+					}
+				} else {
+					return luaL_error(L, "Invalid table format for Matrix4x4 constructor");
+				}
+			} else if (top != 0) {
+				return luaL_error(L, "Invalid arguments for Matrix4x4 constructor");
+			}
+
+			std::copy_n(values, 16, NewVector<plg::mat4x4>(L));
+			return 1;
+		}
+
+		int MatrixIndex(lua_State* L) {
+			CheckVector<plg::mat4x4>(L, 1);
+			if (lua_type(L, 2) == LUA_TSTRING) {
+				size_t length{};
+				const char* key = lua_tolstring(L, 2, &length);
+				if (length == 1 && key[0] == 'm') {
+					// Kept for code written against table-backed matrices,
+					// matrix.m[i][j] reads and writes the matrix itself
+					lua_newuserdatauv(L, 0, 1);
+					lua_pushvalue(L, 1);
+					lua_setiuservalue(L, -2, 1);
+					luaL_setmetatable(L, kRowsName);
+					return 1;
+				}
+			}
+			lua_settop(L, 2);
+			lua_rawget(L, lua_upvalueindex(1)); // methods[key]
+			return 1;
+		}
+
+		int MatrixNewIndex(lua_State* L) {
+			return luaL_error(L, "Matrix4x4 fields are read-only, use set(i, j, value)");
+		}
+
+		int MatrixGet(lua_State* L) {
+			const float* data = CheckVector<plg::mat4x4>(L, 1);
+			const int i = CheckMatrixIndex(L, 2);
+			const int j = CheckMatrixIndex(L, 3);
+			lua_pushnumber(L, data[i * 4 + j]);
+			return 1;
+		}
+
+		int MatrixSet(lua_State* L) {
+			float* data = CheckVector<plg::mat4x4>(L, 1);
+			const int i = CheckMatrixIndex(L, 2);
+			const int j = CheckMatrixIndex(L, 3);
+			data[i * 4 + j] = static_cast<float>(luaL_checknumber(L, 4));
+			return 0;
+		}
+
+		int MatrixTranspose(lua_State* L) {
+			const float* data = CheckVector<plg::mat4x4>(L, 1);
+			float* result = NewVector<plg::mat4x4>(L);
+			for (int i = 0; i < 4; ++i) {
+				for (int j = 0; j < 4; ++j) {
+					result[i * 4 + j] = data[j * 4 + i];
+				}
+			}
+			return 1;
+		}
+
+		int MatrixDeterminant(lua_State* L) {
+			lua_pushnumber(L, Determinant4x4(CheckVector<plg::mat4x4>(L, 1)));
+			return 1;
+		}
+
+		int MatrixInverse(lua_State* L) {
+			const float* data = CheckVector<plg::mat4x4>(L, 1);
+			const lua_Number det = Determinant4x4(data);
+			if (det == 0) {
+				lua_pushnil(L);
+				return 1;
+			}
+			float* result = NewVector<plg::mat4x4>(L);
+			for (int i = 0; i < 4; ++i) {
+				for (int j = 0; j < 4; ++j) {
+					// Cofactor and adjugate (transposed)
+					const lua_Number cofactor = ((i + j) % 2 == 0 ? 1 : -1) * Minor3x3(data, i, j);
+					result[j * 4 + i] = static_cast<float>(cofactor / det);
+				}
+			}
+			return 1;
+		}
+
+		int MatrixMul(lua_State* L) {
+			const float* a = CheckVector<plg::mat4x4>(L, 1);
+			if (lua_type(L, 2) == LUA_TNUMBER) {
+				// Scalar multiplication
+				return PushScaled<plg::mat4x4>(L, a, lua_tonumber(L, 2));
+			}
+			// Matrix multiplication
+			const float* b = CheckVector<plg::mat4x4>(L, 2);
+			float* result = NewVector<plg::mat4x4>(L);
+			for (int i = 0; i < 4; ++i) {
+				for (int j = 0; j < 4; ++j) {
+					float sum = 0;
+					for (int k = 0; k < 4; ++k) {
+						sum += a[i * 4 + k] * b[k * 4 + j];
+					}
+					result[i * 4 + j] = sum;
+				}
+			}
+			return 1;
+		}
+
+		int MatrixTransformVector(lua_State* L) {
+			const float* m = CheckVector<plg::mat4x4>(L, 1);
+			const float* v = CheckVector<plg::vec4>(L, 2);
+			float* result = NewVector<plg::vec4>(L);
+			for (int i = 0; i < 4; ++i) {
+				result[i] = m[i * 4] * v[0] + m[i * 4 + 1] * v[1] + m[i * 4 + 2] * v[2] + m[i * 4 + 3] * v[3];
+			}
+			return 1;
+		}
+
+		int MatrixEquals(lua_State* L) {
+			const float* a = CheckVector<plg::mat4x4>(L, 1);
+			const float* b = TestVector<plg::mat4x4>(L, 2);
+			lua_pushboolean(L, b && std::equal(a, a + 16, b));
+			return 1;
+		}
+
+		int MatrixToString(lua_State* L) {
+			const float* m = CheckVector<plg::mat4x4>(L, 1);
+			std::string str("Matrix4x4(");
+			for (int i = 0; i < 4; ++i) {
+				std::format_to(std::back_inserter(str), "\n{:.2f}, {:.2f}, {:.2f}, {:.2f}", m[i * 4], m[i * 4 + 1], m[i * 4 + 2], m[i * 4 + 3]);
+			}
+			str += ')';
+			lua_pushlstring(L, str.data(), str.size());
+			return 1;
+		}
+
+		// Creates the metatable and the methods table, leaving the latter on the stack
+		template<typename T>
+		void RegisterVector(lua_State* L, const luaL_Reg* metamethods, const luaL_Reg* methods, lua_CFunction index, lua_CFunction newIndex) {
+			luaL_newmetatable(L, VectorTraits<T>::kName); // Stack: mt
+			lua_pushstring(L, VectorTraits<T>::kName);
+			lua_setfield(L, -2, "__type");
+			luaL_setfuncs(L, metamethods, 0);
+			lua_pushcfunction(L, newIndex);
+			lua_setfield(L, -2, "__newindex");
+
+			lua_newtable(L); // Stack: mt, methods
+			luaL_setfuncs(L, methods, 0);
+			lua_pushstring(L, VectorTraits<T>::kName);
+			lua_setfield(L, -2, "__type");
+
+			lua_pushvalue(L, -1);
+			lua_pushcclosure(L, index, 1); // Stack: mt, methods, __index
+			lua_setfield(L, -3, "__index");
+
+			lua_remove(L, -2); // Stack: methods
+		}
+
+		template<typename T>
+		void RegisterVector(lua_State* L) {
+			static const luaL_Reg metamethods[] = {
+				{"__add", VectorAdd<T>},
+				{"__sub", VectorSub<T>},
+				{"__mul", VectorMulOp<T>},
+				{"__div", VectorDivOp<T>},
+				{"__unm", VectorUnm<T>},
+				{"__eq", VectorEquals<T>},
+				{"__tostring", VectorToString<T>},
+				{nullptr, nullptr}
+			};
+			static const luaL_Reg methods[] = {
+				{"new", VectorNew<T>},
+				{"add", VectorAdd<T>},
+				{"sub", VectorSub<T>},
+				{"mul", VectorMul<T>},
+				{"div", VectorDiv<T>},
+				{"dot", VectorDot<T>},
+				{"length", VectorLength<T>},
+				{"sqrLength", VectorSqrLength<T>},
+				{"normalized", VectorNormalized<T>},
+				{"distance", VectorDistance<T>},
+				{"lerp", VectorLerp<T>},
+				{"equals", VectorEquals<T>},
+				{nullptr, nullptr}
+			};
+			RegisterVector<T>(L, metamethods, methods, VectorIndex<T>, VectorNewIndex<T>);
+		}
+
+		void RegisterMatrix(lua_State* L) {
+			static const luaL_Reg metamethods[] = {
+				{"__mul", MatrixMul},
+				{"__eq", MatrixEquals},
+				{"__tostring", MatrixToString},
+				{nullptr, nullptr}
+			};
+			static const luaL_Reg methods[] = {
+				{"new", MatrixNew},
+				{"get", MatrixGet},
+				{"set", MatrixSet},
+				{"transpose", MatrixTranspose},
+				{"determinant", MatrixDeterminant},
+				{"inverse", MatrixInverse},
+				{"mul", MatrixMul},
+				{"transformVector", MatrixTransformVector},
+				{"equals", MatrixEquals},
+				{nullptr, nullptr}
+			};
+			RegisterVector<plg::mat4x4>(L, metamethods, methods, MatrixIndex, MatrixNewIndex);
+
+			static const luaL_Reg rowsMetamethods[] = {
+				{"__index", MatrixRowsIndex},
+				{"__newindex", MatrixRowsNewIndex},
+				{"__len", ViewLength},
+				{nullptr, nullptr}
+			};
+			static const luaL_Reg rowMetamethods[] = {
+				{"__index", MatrixRowIndex},
+				{"__newindex", MatrixRowNewIndex},
+				{"__len", ViewLength},
+				{nullptr, nullptr}
+			};
+			luaL_newmetatable(L, kRowsName);
+			luaL_setfuncs(L, rowsMetamethods, 0);
+			luaL_newmetatable(L, kRowName);
+			luaL_setfuncs(L, rowMetamethods, 0);
+			lua_pop(L, 2);
+		}
+	}
+
+	int OpenVectorLib(lua_State* L) {
+		lua_createtable(L, 0, 4);
+
+		RegisterVector<plg::vec2>(L);
+		lua_setfield(L, -2, "Vector2");
+
+		RegisterVector<plg::vec3>(L);
+		lua_pushcfunction(L, Vector3Cross);
+		lua_setfield(L, -2, "cross");
+		lua_setfield(L, -2, "Vector3");
+
+		RegisterVector<plg::vec4>(L);
+		lua_setfield(L, -2, "Vector4");
+
+		RegisterMatrix(L);
+		lua_setfield(L, -2, "Matrix4x4");
+
+		return 1;
+	}
+}
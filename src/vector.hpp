@@ -0,0 +1,88 @@
+#pragma once
+
+#include <plg/any.hpp>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace lualm {
+	// Vector2/3/4 and Matrix4x4 are full userdata holding raw floats
+	// (row-major for the matrix), with metatables registered under their type names.
+	template<typename T>
+	struct VectorTraits;
+
+	template<>
+	struct VectorTraits<plg::vec2> {
+		static constexpr int kSize = 2;
+		static constexpr const char* kName = "Vector2";
+	};
+
+	template<>
+	struct VectorTraits<plg::vec3> {
+		static constexpr int kSize = 3;
+		static constexpr const char* kName = "Vector3";
+	};
+
+	template<>
+	struct VectorTraits<plg::vec4> {
+		static constexpr int kSize = 4;
+		static constexpr const char* kName = "Vector4";
+	};
+
+	template<>
+	struct VectorTraits<plg::mat4x4> {
+		static constexpr int kSize = 16;
+		static constexpr const char* kName = "Matrix4x4";
+	};
+
+	inline void StoreVector(float* out, const plg::vec2& value) {
+		out[0] = value.x;
+		out[1] = value.y;
+	}
+
+	inline void StoreVector(float* out, const plg::vec3& value) {
+		out[0] = value.x;
+		out[1] = value.y;
+		out[2] = value.z;
+	}
+
+	inline void StoreVector(float* out, const plg::vec4& value) {
+		out[0] = value.x;
+		out[1] = value.y;
+		out[2] = value.z;
+		out[3] = value.w;
+	}
+
+	inline void StoreVector(float* out, const plg::mat4x4& value) {
+		std::copy(std::begin(value.data), std::end(value.data), out);
+	}
+
+	inline void LoadVector(const float* in, plg::vec2& value) {
+		value.x = in[0];
+		value.y = in[1];
+	}
+
+	inline void LoadVector(const float* in, plg::vec3& value) {
+		value.x = in[0];
+		value.y = in[1];
+		value.z = in[2];
+	}
+
+	inline void LoadVector(const float* in, plg::vec4& value) {
+		value.x = in[0];
+		value.y = in[1];
+		value.z = in[2];
+		value.w = in[3];
+	}
+
+	inline void LoadVector(const float* in, plg::mat4x4& value) {
+		std::copy(in, in + VectorTraits<plg::mat4x4>::kSize, std::begin(value.data));
+	}
+
+	// Opens the native vector library: registers metatables and returns
+	// a table with Vector2, Vector3, Vector4 and Matrix4x4 class tables.
+	int OpenVectorLib(lua_State* L);
+}
@@ -0,0 +1,183 @@
+local master = require 'cross_call_master'
+local plugify = require 'plugify'
+local Plugin = plugify.Plugin
+
+-- Same parsing as the module, unset or malformed means off
+local function env_flag(name)
+    local value = os.getenv(name)
+    return value == "1" or value == "true" or value == "on"
+end
+
+local function env_size(name)
+    local value = os.getenv(name)
+    if not value then
+        return 0
+    end
+    local number, suffix = value:match("^(%d+)([KkMmGg]?)$")
+    if not number then
+        return 0
+    end
+    local scale = { [""] = 1, k = 1024, m = 1024 * 1024, g = 1024 * 1024 * 1024 }
+    return tonumber(number) * scale[suffix:lower()]
+end
+
+local failures = 0
+
+local function check(name, ok, detail)
+    if ok then
+        print("LuaModuleSmoke: PASS " .. name)
+    else
+        failures = failures + 1
+        print("LuaModuleSmoke: FAIL " .. name .. (detail and (" (" .. detail .. ")") or ""))
+    end
+end
+
+-- Test part
+
+-- cross_call_worker is a dependency, so it is loaded already. With one state
+-- per plugin its module must not be visible here.
+local function test_isolation()
+    local shared = package.loaded["cross_call_worker"] ~= nil
+    if env_flag("LUALM_ISOLATED_PLUGINS") then
+        check("isolation: worker module not visible", not shared)
+    else
+        check("isolation: worker module shared", shared)
+    end
+end
+
+local function test_memory_limit()
+    local stats = plugify.memory_stats()
+    check("memory: stats reported", stats.bytes_in_use > 0 and stats.peak_bytes >= stats.bytes_in_use)
+
+    local limit = env_size("LUALM_MEMORY_HARD_LIMIT")
+    if limit == 0 then
+        check("memory: no per-plugin stats without accounting",
+            stats.plugin == nil or env_flag("LUALM_MEMORY_ACCOUNTING") or env_size("LUALM_MEMORY_SOFT_LIMIT") ~= 0)
+        return
+    end
+
+    check("memory: plugin stats reported", stats.plugin ~= nil and stats.plugin.name == "lua_module_smoke")
+    check("memory: hard limit applied", stats.plugin ~= nil and stats.plugin.hard_limit == limit,
+        stats.plugin and tostring(stats.plugin.hard_limit))
+
+    -- Must fail as a protected error inside this call, not take the module down
+    local ok, err = pcall(string.rep, "x", limit + 1)
+    check("memory: allocation past the hard limit fails", not ok, ok and "allocation succeeded" or nil)
+    check("memory: failure is an out of memory error", not ok and tostring(err):find("not enough memory") ~= nil, tostring(err))
+
+    local after = plugify.memory_stats()
+    check("memory: failure counted", after.plugin.limit_failures > stats.plugin.limit_failures)
+
+    -- The state stays usable once the garbage is gone
+    collectgarbage()
+    check("memory: state usable after failure", #string.rep("x", 1024) == 1024)
+end
+
+local function test_callback_cache()
+    local calls = 0
+    local function callback()
+        calls = calls + 1
+    end
+
+    -- Passing the same function twice reuses its thunk and counts two hand-outs
+    master:CallFuncVoidCallback(callback)
+    master:CallFuncVoidCallback(callback)
+    check("callbacks: thunk callable", calls == 2, tostring(calls))
+    check("callbacks: first release", plugify.release_callback(callback) == true)
+    check("callbacks: last release", plugify.release_callback(callback) == true)
+    check("callbacks: nothing left to release", plugify.release_callback(callback) == false)
+
+    -- A released function gets a fresh thunk
+    master:CallFuncVoidCallback(callback)
+    check("callbacks: callable after release", calls == 3, tostring(calls))
+    check("callbacks: release again", plugify.release_callback(callback) == true)
+
+    check("callbacks: unknown function", plugify.release_callback(function() end) == false)
+end
+
+-- Reloading while the plugin sits at its hard limit. The module's own
+-- bookkeeping must never be refused there, so the reload either completes
+-- or keeps the old instance running. A panic of the host is the failure.
+-- Nothing is reported until the ballast is gone, reporting allocates too.
+local ballast
+local reload_requested
+local reload_updates = 0
+local restored_failures
+
+local function grow(size)
+    ballast[#ballast + 1] = string.rep("x", size)
+end
+
+local function test_reload_at_limit()
+    if env_size("LUALM_MEMORY_HARD_LIMIT") == 0 then
+        return false
+    end
+    ballast = {}
+    local size = 4096
+    while size >= 64 do
+        if not pcall(grow, size) then
+            size = size // 2
+        end
+    end
+    reload_requested = plugify.reload_plugin("lua_module_smoke")
+    return true
+end
+
+local function finish()
+    if failures ~= 0 then
+        error(string.format("LuaModuleSmoke: %d check(s) failed", failures))
+    end
+    print("LuaModuleSmoke: all checks passed")
+end
+
+local LuaModuleSmoke = {}
+setmetatable(LuaModuleSmoke, { __index = Plugin })
+
+-- Define the plugin_start method
+function LuaModuleSmoke:plugin_start()
+    if restored_failures then
+        -- The reload at the hard limit went through
+        failures = restored_failures
+        check("reload: new instance started at the hard limit", true)
+        finish()
+        return
+    end
+    test_isolation()
+    test_memory_limit()
+    test_callback_cache()
+    if not test_reload_at_limit() then
+        finish()
+    end
+end
+
+-- Define the plugin_update method
+function LuaModuleSmoke:plugin_update(dt)
+    if not ballast then
+        return
+    end
+    -- The module handles the reload in one of the next updates
+    reload_updates = reload_updates + 1
+    if reload_updates < 3 then
+        return
+    end
+    ballast = nil
+    collectgarbage()
+    check("reload: requested at the hard limit", reload_requested == true)
+    check("reload: old instance kept running at the hard limit", true)
+    finish()
+end
+
+-- A number, a table could not be allocated at the limit
+function LuaModuleSmoke:plugin_save_state()
+    return failures
+end
+
+function LuaModuleSmoke:plugin_restore_state(state)
+    restored_failures = state
+end
+
+local M = {}
+
+M.LuaModuleSmoke = LuaModuleSmoke
+
+return M